@@ -0,0 +1,186 @@
+#include "nes/emulator/console.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Fnv1a
+    {
+        std::uint64_t value = 0xCBF29CE484222325;
+        void update(const void* data, std::size_t size) noexcept
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                value ^= static_cast<const unsigned char*>(data)[i];
+                value *= 0x100000001B3;
+            }
+        }
+    };
+
+    void output_samples(void* audio_hash, const blip_sample_t* samples, size_t count) noexcept
+    {
+        static_cast<Fnv1a*>(audio_hash)->update(samples, count * sizeof *samples);
+    }
+
+    struct Result
+    {
+        std::string   status = "not run";
+        double        frames_per_second = 0;
+        std::uint64_t video_hash = 0, audio_hash = 0;
+    };
+
+    Result run_rom(const std::string& rom, long frames, bool sound)
+    {
+        Result result;
+        try
+        {
+            nes::emulator::Console console{rom};
+            console.set_audio_synthesis(sound);
+
+            Fnv1a audio_hash;
+            console.set_audio_output(::output_samples, &audio_hash);
+
+            const auto start_time = std::chrono::steady_clock::now();
+            for (long frame = 0; frame < frames; ++frame) console.run_frame();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+            Fnv1a video_hash;
+            video_hash.update(console.get_framebuffer(), 256 * 240);
+
+            result.status            = "ok";
+            result.frames_per_second = frames / seconds;
+            result.video_hash        = video_hash.value;
+            result.audio_hash        = audio_hash.value;
+        }
+        catch (const std::exception& ex)
+        {
+            result.status = std::string{"error: "} + ex.what();
+        }
+        return result;
+    }
+
+    // Every worker takes the ROMs dealt to it from the back of its own queue and, once that is
+    // empty, steals from the front of the others', so a few slow ROMs do not leave cores idle
+    class WorkQueues final
+    {
+        struct Queue
+        {
+            std::mutex              mutex;
+            std::deque<std::size_t> jobs;
+        };
+
+        std::vector<Queue> queues;
+
+    public:
+        WorkQueues(std::size_t workers, std::size_t jobs) : queues(workers)
+        {
+            for (std::size_t job = 0; job < jobs; ++job) queues[job % workers].jobs.push_back(job);
+        }
+
+        // false once every queue is empty; no job is added after the start
+        bool next(std::size_t worker, std::size_t& job)
+        {
+            for (std::size_t i = 0; i < queues.size(); ++i)
+            {
+                Queue& queue = queues[(worker + i) % queues.size()];
+                const std::lock_guard<std::mutex> lock{queue.mutex};
+                if (queue.jobs.empty()) continue;
+                if (i) {job = queue.jobs.front(); queue.jobs.pop_front();}
+                else   {job = queue.jobs.back();  queue.jobs.pop_back();}
+                return true;
+            }
+            return false;
+        }
+    };
+
+    std::vector<std::string> list_roms(char** paths, int count)
+    {
+        std::vector<std::string> roms;
+        for (int i = 0; i < count; ++i)
+        {
+            if (!std::filesystem::is_directory(paths[i])) {roms.emplace_back(paths[i]); continue;}
+
+            std::vector<std::string> found;
+            for (const auto& entry : std::filesystem::recursive_directory_iterator{paths[i]})
+            {
+                std::string extension = entry.path().extension().string();
+                std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {return std::tolower(c);});
+                if (entry.is_regular_file() && extension == ".nes") found.push_back(entry.path().string());
+            }
+            std::sort(found.begin(), found.end());
+            roms.insert(roms.end(), found.begin(), found.end());
+        }
+        return roms;
+    }
+
+    void run(const std::vector<std::string>& roms, long frames, unsigned threads, bool sound)
+    {
+        std::vector<Result> results(roms.size());
+        WorkQueues queues{threads, roms.size()};
+
+        const auto start_time = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned worker = 0; worker < threads; ++worker)
+            workers.emplace_back([&, worker]
+            {
+                for (std::size_t job; queues.next(worker, job);) results[job] = run_rom(roms[job], frames, sound);
+            });
+        for (auto& worker : workers) worker.join();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+        std::size_t run_roms = 0;
+        std::cout << "frames per second\tframebuffer hash\taudio hash\tstatus\tfile\n";
+        for (std::size_t i = 0; i < roms.size(); ++i)
+        {
+            const Result& result = results[i];
+            run_roms += result.status == "ok";
+            std::cout << result.frames_per_second << '\t' << std::hex << result.video_hash << '\t' << result.audio_hash << std::dec <<
+                         '\t' << result.status << '\t' << roms[i] << '\n';
+        }
+        std::cout << "ROMs run:            \t" << run_roms << " of " << roms.size()         << '\n' <<
+                     "threads:             \t" << threads                                    << '\n' <<
+                     "seconds:             \t" << seconds                                    << '\n' <<
+                     "total frames/second: \t" << run_roms * frames / seconds                << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if (argc < 4)
+            throw std::runtime_error{"emunes-batch 'frames' 'threads, 0 for one per core' ['no-sound'] 'filepath or directory'..."};
+        const long frames = std::atol(argv[1]);
+        if (frames <= 0)
+            throw std::runtime_error{"the frame count must be positive"};
+        const long threads = std::atol(argv[2]);
+        if (threads < 0)
+            throw std::runtime_error{"the thread count cannot be negative"};
+
+        const bool sound = std::string_view{argv[3]} != "no-sound";
+        const auto roms = ::list_roms(argv + 4 - sound, argc - 4 + sound);
+        if (roms.empty())
+            throw std::runtime_error{"no ROMs found"};
+        const unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+        ::run(roms, frames, std::min<std::size_t>(threads ? threads : hardware_threads, roms.size()), sound);
+    }
+    catch (const std::exception& ex)
+    {
+        std::clog << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
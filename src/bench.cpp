@@ -0,0 +1,154 @@
+#include "nes/emulator/console.h"
+#include "nes/emulator/rewind.h"
+#include "nes/emulator/recompiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+namespace
+{
+    struct Fnv1a
+    {
+        std::uint64_t value = 0xCBF29CE484222325;
+        void update(const void* data, std::size_t size) noexcept
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                value ^= static_cast<const unsigned char*>(data)[i];
+                value *= 0x100000001B3;
+            }
+        }
+    };
+
+    void output_samples(void* audio_hash, const blip_sample_t* samples, size_t count) noexcept
+    {
+        static_cast<Fnv1a*>(audio_hash)->update(samples, count * sizeof *samples);
+    }
+
+    enum class Core {interpreter, jit, jit_compare};
+
+    void run(const char* rom, long frames, unsigned rewind_interval, Core core, bool skip_idle_loops, bool sound,
+             nes::emulator::Accuracy accuracy)
+    {
+        nes::emulator::Console console{rom};
+        console.set_accuracy(accuracy);
+        console.set_idle_loop_skipping(skip_idle_loops);
+        console.set_audio_synthesis(sound);
+
+        std::unique_ptr<nes::emulator::Recompiler> recompiler;
+        if (core != Core::interpreter)
+        {
+            recompiler = std::make_unique<nes::emulator::Recompiler>(core == Core::jit_compare);
+            console.set_recompiler(recompiler.get());
+        }
+
+        Fnv1a audio_hash;
+        console.set_audio_output(::output_samples, &audio_hash);
+
+        nes::emulator::Rewind rewind{console.machine(), 4 << 20, rewind_interval};
+        std::chrono::steady_clock::duration capture_time{};
+
+        long long cpu_cycles = 0;
+
+        const auto start_time = std::chrono::steady_clock::now();
+        for (long frame = 0; frame < frames; ++frame)
+        {
+            cpu_cycles += console.run_frame();
+
+            if (rewind_interval)
+            {
+                const auto capture_start = std::chrono::steady_clock::now();
+                rewind.frame();
+                capture_time += std::chrono::steady_clock::now() - capture_start;
+            }
+        }
+        // the capture time is not part of the emulation
+        const auto elapsed_time = std::chrono::steady_clock::now() - start_time - capture_time;
+
+        const double ns      = std::chrono::duration<double, std::nano>(elapsed_time).count();
+        const double seconds = ns / 1e9;
+
+        Fnv1a video_hash;
+        video_hash.update(console.get_framebuffer(), 256 * 240);
+
+        std::cout << "frames:              \t" << frames                          << '\n' <<
+                     "seconds:             \t" << seconds                         << '\n' <<
+                     "frames per second:   \t" << frames / seconds                << '\n' <<
+                     "ns per CPU cycle:    \t" << ns / cpu_cycles                 << '\n' <<
+                     "ns per PPU tick:     \t" << ns / (3 * cpu_cycles)           << '\n' <<
+                     "framebuffer hash:    \t" << std::hex << video_hash.value    << '\n' <<
+                     "audio hash:          \t" << audio_hash.value << std::dec    << std::endl;
+
+        if (recompiler)
+        {
+            const auto& stats = recompiler->get_stats();
+            std::cout << "blocks translated:   \t" << stats.translated                                     << '\n' <<
+                         "blocks run:          \t" << stats.executed                                       << '\n' <<
+                         "instructions per run:\t" << (stats.executed ? double(stats.instructions) / stats.executed : 0) << '\n' <<
+                         "mismatches:          \t" << stats.mismatches                                     << std::endl;
+        }
+
+        if (!rewind_interval) return;
+
+        const std::size_t history = rewind.history_bytes(), held = rewind.history_captures();
+        double slowest_step = 0;
+        while (true)
+        {
+            const auto step_start = std::chrono::steady_clock::now();
+            if (!rewind.step()) break;
+            slowest_step = std::max(slowest_step, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - step_start).count());
+        }
+
+        std::cout << "state bytes:         \t" << rewind.state_bytes()                                                   << '\n' <<
+                     "rewind history:      \t" << held << " captures, " << history << " bytes"                            << '\n' <<
+                     "bytes per frame:     \t" << (rewind.deltas() ? double(rewind.delta_bytes()) / (rewind.deltas() * rewind_interval) : 0) << '\n' <<
+                     "us per capture:      \t" << (rewind.captures() ? std::chrono::duration<double, std::micro>(capture_time).count() /
+                                                    rewind.captures() : 0)                                               << '\n' <<
+                     "us per rewind step:  \t" << slowest_step << " (slowest)"                                           << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        if (argc < 2 || argc > 8)
+            throw std::runtime_error{"emunes-bench 'filepath' ['frames'] ['rewind interval'] ['interpreter', 'jit' or 'jit-compare'] "
+                                     "['idle' or 'no-idle'] ['sound' or 'no-sound'] ['exact' or 'fast']"};
+        const long frames = argc >= 3 ? std::atol(argv[2]) : 600;
+        if (frames <= 0)
+            throw std::runtime_error{"the frame count must be positive"};
+        const long rewind_interval = argc >= 4 ? std::atol(argv[3]) : 0;
+        if (rewind_interval < 0)
+            throw std::runtime_error{"the rewind interval cannot be negative"};
+        const std::string_view core_name = argc >= 5 ? argv[4] : "interpreter";
+        ::Core core;
+             if (core_name == "interpreter") core = ::Core::interpreter;
+        else if (core_name == "jit")         core = ::Core::jit;
+        else if (core_name == "jit-compare") core = ::Core::jit_compare;
+        else throw std::runtime_error{"the core is 'interpreter', 'jit' or 'jit-compare'"};
+        const std::string_view idle = argc >= 6 ? argv[5] : "idle";
+        if (idle != "idle" && idle != "no-idle")
+            throw std::runtime_error{"idle loop skipping is 'idle' or 'no-idle'"};
+        const std::string_view sound = argc >= 7 ? argv[6] : "sound";
+        if (sound != "sound" && sound != "no-sound")
+            throw std::runtime_error{"the sound is 'sound' or 'no-sound'"};
+        const std::string_view accuracy = argc == 8 ? argv[7] : "exact";
+        if (accuracy != "exact" && accuracy != "fast")
+            throw std::runtime_error{"the accuracy is 'exact' or 'fast'"};
+        ::run(argv[1], frames, rewind_interval, core, idle == "idle", sound == "sound",
+              accuracy == "exact" ? nes::emulator::Accuracy::exact : nes::emulator::Accuracy::fast);
+    }
+    catch (const std::exception& ex)
+    {
+        std::clog << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
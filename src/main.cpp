@@ -1,15 +1,23 @@
-#include "nes/emulator/cartridge.h"
-#include "nes/emulator/cpu.h"
-#include "nes/emulator/ppu.h"
-#include "nes/emulator/apu.h"
-#include "nes/emulator/controller.h"
+#include "nes/emulator/console.h"
+#include "nes/emulator/scaler.h"
 
-#include "nes/emulator/third_party/Nes_Snd_Emu-0.1.7/Sound_Queue.h"
 #include "nes/emulator/third_party/nes_ntsc-0.2.2/nes_ntsc.h"
 
 #include <SDL2/SDL.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 namespace
 {
@@ -58,68 +66,374 @@ namespace
         ~SDLtexture() {::SDL_DestroyTexture(handle);}
     };
 
-    Sound_Queue sound_queue;
+    constexpr int ntsc_out_width = NES_NTSC_OUT_WIDTH(256);
 
-    int dmc_read(void* user_data, cpu_addr_t address) noexcept {return static_cast<nes::emulator::CPU*>(user_data)->dmc_read(user_data, address);}
-    void output_samples(const blip_sample_t* samples, size_t count) noexcept {sound_queue.write(samples, count);}
+    // the composite NTSC filter, or the plain palette colors scaled 1 to 4 times (scale 0: NTSC)
+    struct Video : NonCopyable
+    {
+        unsigned      scale;
+        nes_ntsc_t    ntsc;
+        std::uint32_t colors[64];
+
+        explicit Video(unsigned scale) noexcept : scale{scale}
+        {
+            nes_ntsc_setup_t setup = nes_ntsc_composite;
+            unsigned char rgb[64 * 3];
+            setup.merge_fields = 0;
+            setup.palette_out  = rgb;
+            ::nes_ntsc_init(&ntsc, &setup);
+            for (int i = 0; i < 64; ++i) colors[i] = rgb[3 * i] << 16 | rgb[3 * i + 1] << 8 | rgb[3 * i + 2];
+        }
+
+        int width()  const noexcept {return scale ? 256 * scale : ntsc_out_width;}
+        int height() const noexcept {return scale ? 240 * scale : 240;}
+
+        // the rows [first, last) of a frame into XRGB8888 pixels
+        void filter(const unsigned char* frame, int first, int last, int burst_phase, unsigned char* pixels, int pitch) const noexcept
+        {
+            if (scale) nes::emulator::scale_rows(frame + first * 256, last - first, colors, scale, pixels + first * scale * pitch, pitch);
+            else       ::nes_ntsc_blit(&ntsc, frame + first * 256, 256, (burst_phase + first) % nes_ntsc_burst_count, 256, last - first,
+                                       pixels + first * pitch, pitch);
+        }
+    };
 
-    void run(const char* rom)
+    // Filters frames straight into the 32-bit pixels of a locked texture on worker threads, each one a
+    // band of rows
+    class VideoPipeline final : NonCopyable
     {
-        auto cartridge{nes::emulator::Cartridge::load(rom)};
-        nes::emulator::CPU cpu;
-        nes::emulator::PPU ppu;
-        nes::emulator::APU apu;
-        nes::emulator::Controller controller;
+        const Video&   video;
+        const unsigned bands;
 
-        nes::emulator::CPU::MemPointers mem_pointers;
-        mem_pointers.ppu            = &ppu;
-        mem_pointers.apu            = &apu;
-        mem_pointers.cartridge      = &cartridge;
-        mem_pointers.controller     = &controller;
-        cpu.set_mem_pointers(mem_pointers);
+        const unsigned char* frame = nullptr;
+        int burst_phase = 0;
+        unsigned char* pixels = nullptr;
+        int pitch = 0;
 
-        nes::emulator::PPU::MemPointers mem_pointers_ppu;
-        mem_pointers_ppu.cartridge      = &cartridge;
-        mem_pointers_ppu.cpu            = &cpu;
-        ppu.set_mem_pointers(mem_pointers_ppu);
+        std::mutex              mutex;
+        std::condition_variable start, done;
+        unsigned long           generation = 0;
+        unsigned                busy = 0;
+        bool                    stopping = false;
 
-        apu.set_dmc_reader(::dmc_read, &cpu);
-        apu.set_output_samples(::output_samples);
+        std::vector<std::thread> workers;
 
-        unsigned char framebuffer[256 * 240];
-        ppu.set_pixel_output(framebuffer);
+        void work(unsigned band) noexcept
+        {
+            const int first = 240 * band / bands, last = 240 * (band + 1) / bands;
+            for (unsigned long seen = 0;;)
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                start.wait(lock, [&] {return stopping || generation != seen;});
+                if (stopping) return;
+                seen = generation;
+                lock.unlock();
 
-        nes_ntsc_setup_t nes_ntsc_setup = nes_ntsc_composite;
-        nes_ntsc_t nes_ntsc;
+                video.filter(frame, first, last, burst_phase, pixels, pitch);
 
-        nes_ntsc_setup.merge_fields = 0;
+                lock.lock();
+                if (!--busy) done.notify_one();
+            }
+        }
 
-        ::nes_ntsc_init(&nes_ntsc, &nes_ntsc_setup);
+    public:
+        // a band is one row at least
+        VideoPipeline(const Video& video, unsigned threads) : video{video}, bands{std::min(threads, 240u)}
+        {
+            for (unsigned band = 0; band < bands; ++band) workers.emplace_back(&VideoPipeline::work, this, band);
+        }
+        ~VideoPipeline()
+        {
+            {
+                const std::lock_guard<std::mutex> lock{mutex};
+                stopping = true;
+            }
+            start.notify_all();
+            for (auto& worker : workers) worker.join();
+        }
 
-        constexpr int ntsc_out_width = NES_NTSC_OUT_WIDTH(256), render_height = 240 * 2;
+        // after wait(), if anything was submitted before; pixels: XRGB8888 rows of video.width(). The
+        // frame and the pixels have to stay valid until wait() returns
+        void submit(const unsigned char* frame, int burst_phase, void* pixels, int pitch)
+        {
+            {
+                const std::lock_guard<std::mutex> lock{mutex};
+                this->frame       = frame;
+                this->burst_phase = burst_phase;
+                this->pixels      = static_cast<unsigned char*>(pixels);
+                this->pitch       = pitch;
+                busy = bands;
+                ++generation;
+            }
+            start.notify_all();
+        }
 
-        std::uint_least16_t pixel_output[ntsc_out_width * 240];
-        int burst_phase = 0;
+        // until the frame submitted last is in its pixels
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            done.wait(lock, [this] {return !busy;});
+        }
+    };
+
+    // Hands the newest frame from one producer to one consumer without locks: each side owns one of
+    // three slots and swaps it with the spare one, which also carries whether it holds a new frame
+    class TripleBuffer final : NonCopyable
+    {
+    public:
+        struct Frame
+        {
+            unsigned char pixels[256 * 240];
+            unsigned long number;
+        };
+
+    private:
+        static constexpr unsigned fresh = 4;
+
+        Frame frames[3];
+        std::atomic<unsigned> spare{1};
+        unsigned back = 0, front = 2;
+
+    public:
+        // the producer's slot, until publish()
+        Frame& back_frame() noexcept {return frames[back];}
+        void publish() noexcept {back = spare.exchange(back | fresh, std::memory_order_acq_rel) & 3;}
+
+        // the consumer's slot with the newest frame, until the next call; null if none came since then
+        const Frame* newest() noexcept
+        {
+            if (!(spare.load(std::memory_order_relaxed) & fresh)) return nullptr;
+            front = spare.exchange(front, std::memory_order_acq_rel) & 3;
+            return &frames[front];
+        }
+    };
+
+    // single producer, single consumer; a full queue drops the new item
+    template<class T, std::size_t capacity>
+    class SpscQueue final : NonCopyable
+    {
+        T items[capacity];
+        std::atomic<std::size_t> head{0}, tail{0}; // head: next to pop, tail: next to push
+
+    public:
+        bool push(const T& item) noexcept
+        {
+            const std::size_t at = tail.load(std::memory_order_relaxed);
+            if (at - head.load(std::memory_order_acquire) == capacity) return false;
+            items[at % capacity] = item;
+            tail.store(at + 1, std::memory_order_release);
+            return true;
+        }
+        bool pop(T& item) noexcept
+        {
+            const std::size_t at = head.load(std::memory_order_relaxed);
+            if (at == tail.load(std::memory_order_acquire)) return false;
+            item = items[at % capacity];
+            head.store(at + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    // Carries the samples from the emulation thread to the SDL audio callback without locks. The
+    // emulation keeps it near the target latency's worth; it holds twice that at most: the samples past
+    // it are dropped (an overrun) and the callback holds the last sample for the ones missing (an
+    // underrun), so neither side ever waits
+    class AudioRing final : NonCopyable
+    {
+        std::vector<blip_sample_t> samples; // a power of 2
+        const std::size_t target, limit;
+        std::atomic<std::size_t> head{0}, tail{0}; // head: next to read, tail: next to write
+
+        blip_sample_t last = 0;
+        bool started = false; // no underruns before the first sample
+
+        std::atomic<unsigned long> overruns{0}, underruns{0};
+
+        static std::size_t round_up(std::size_t size) noexcept
+        {
+            std::size_t power = 1;
+            while (power < size) power *= 2;
+            return power;
+        }
+
+        // the count up to the end of the ring from at
+        std::size_t first_part(std::size_t at, std::size_t count) const noexcept
+        {
+            return std::min(count, samples.size() - (at & (samples.size() - 1)));
+        }
+
+    public:
+        explicit AudioRing(std::size_t target) : samples(round_up(2 * target)), target{target}, limit{2 * target} {}
+
+        // from the emulation thread
+        void write(const blip_sample_t* in, std::size_t count) noexcept
+        {
+            const std::size_t at = tail.load(std::memory_order_relaxed), used = at - head.load(std::memory_order_acquire);
+            const std::size_t written = std::min(count, limit - std::min(used, limit));
+            if (written < count) overruns.fetch_add(1, std::memory_order_relaxed);
+            const std::size_t first = first_part(at, written);
+            std::copy_n(in, first, samples.data() + (at & (samples.size() - 1)));
+            std::copy_n(in + first, written - first, samples.data());
+            tail.store(at + written, std::memory_order_release);
+        }
+
+        // from the audio callback
+        void read(blip_sample_t* out, std::size_t count) noexcept
+        {
+            const std::size_t at = head.load(std::memory_order_relaxed), available = tail.load(std::memory_order_acquire) - at;
+            const std::size_t taken = std::min(count, available);
+            const std::size_t first = first_part(at, taken);
+            std::copy_n(samples.data() + (at & (samples.size() - 1)), first, out);
+            std::copy_n(samples.data(), taken - first, out + first);
+            head.store(at + taken, std::memory_order_release);
+
+            if (taken) {last = out[taken - 1]; started = true;}
+            if (taken < count)
+            {
+                std::fill(out + taken, out + count, last);
+                if (started) underruns.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // the samples waiting, from either side
+        std::size_t size() const noexcept {return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);}
+        std::size_t get_target() const noexcept {return target;}
+
+        unsigned long get_overruns()  const noexcept {return  overruns.load(std::memory_order_relaxed);}
+        unsigned long get_underruns() const noexcept {return underruns.load(std::memory_order_relaxed);}
+    };
+
+    void output_samples(void* audio_ring, const blip_sample_t* samples, size_t count) noexcept
+    {
+        static_cast<AudioRing*>(audio_ring)->write(samples, count);
+    }
+
+    // plays an AudioRing, pulling a few milliseconds at a time
+    struct SDLaudio : NonCopyable
+    {
+        SDL_AudioDeviceID handle;
+        SDLaudio(AudioRing& ring, int frequency, Uint16 samples)
+        {
+            SDL_AudioSpec spec{};
+            spec.freq     = frequency;
+            spec.format   = AUDIO_S16SYS;
+            spec.channels = 1;
+            spec.samples  = samples;
+            spec.callback = [](void* ring, Uint8* stream, int bytes)
+            {
+                static_cast<AudioRing*>(ring)->read(reinterpret_cast<blip_sample_t*>(stream), bytes / sizeof(blip_sample_t));
+            };
+            spec.userdata = &ring;
+            if ((handle = ::SDL_OpenAudioDevice(nullptr, 0, &spec, nullptr, 0)) == 0)
+                throw std::runtime_error{::SDL_GetError()};
+            ::SDL_PauseAudioDevice(handle, 0);
+        }
+        ~SDLaudio() {::SDL_CloseAudioDevice(handle);}
+    };
+
+    // Runs the console at the NTSC frame rate on its own thread: the controller states come in through
+    // a queue, the frames go out through a triple buffer and the samples through an audio ring
+    class Emulation final : NonCopyable
+    {
+        nes::emulator::Console& console;
+        TripleBuffer&           frames;
+        const AudioRing&        audio;
+
+        SpscQueue<unsigned char, 64> keys;
+        std::atomic<bool>            running{true};
+        std::thread                  thread;
+
+        // The audio device plays by its own clock, which is never quite the one the frames are paced
+        // by: the ring's level, smoothed over about 20 frames, steers the audio rate by up to this
+        static constexpr double max_rate_change = 0.005;
+
+        void run() noexcept
+        {
+            using clock = std::chrono::steady_clock;
+            constexpr double cycle_ns = 1e9 / nes::emulator::APU::clock_rate;
+
+            // the frames end on the CPU cycles run since the start, so no rounding adds up
+            auto start = clock::now();
+            double cycles = 0, level = 0;
+            for (unsigned long number = 0; running.load(std::memory_order_relaxed); ++number)
+            {
+                // the newest state wins
+                for (unsigned char state; keys.pop(state);) console.set_port_keys<0>(state);
+                cycles += console.run_frame();
+
+                const double error = (static_cast<double>(audio.size()) - audio.get_target()) / audio.get_target();
+                level += (std::clamp(error, -1.0, 1.0) - level) / 20;
+                console.set_audio_rate(1 + max_rate_change * level);
+
+                TripleBuffer::Frame& frame = frames.back_frame();
+                std::memcpy(frame.pixels, console.get_framebuffer(), sizeof frame.pixels);
+                frame.number = number;
+                frames.publish();
+
+                // a late frame does not make the next ones faster
+                const auto next = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::nano>(cycles * cycle_ns));
+                const auto now  = clock::now();
+                if (next < now) {start = now; cycles = 0;}
+                else std::this_thread::sleep_until(next);
+            }
+        }
+
+    public:
+        Emulation(nes::emulator::Console& console, TripleBuffer& frames, const AudioRing& audio) :
+            console{console}, frames{frames}, audio{audio}, thread{&Emulation::run, this} {}
+        ~Emulation()
+        {
+            running = false;
+            thread.join();
+        }
+
+        void set_keys(unsigned char state) noexcept {keys.push(state);}
+    };
+
+    void run(const char* rom, unsigned scale, unsigned audio_latency)
+    {
+        nes::emulator::Console console{rom};
+
+        // a frame's samples at least; the device takes an eighth of the latency or less at a time
+        constexpr int audio_frequency = 44100;
+        const std::size_t latency_samples = std::max<std::size_t>(audio_frequency * audio_latency / 1000,
+                                                                  (audio_frequency + 59) / 60);
+        Uint16 device_samples = 128;
+        while (device_samples < 2048 && device_samples * 8 <= latency_samples) device_samples *= 2;
+
+        AudioRing audio_ring{latency_samples};
+        console.set_audio_output(::output_samples, &audio_ring);
+
+        const auto video = std::make_unique<Video>(scale);
+
+        // the NTSC rows are shown twice as high
+        const int render_width = video->width(), render_height = scale ? video->height() : 240 * 2;
 
         const SDL sdl{SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER | SDL_INIT_AUDIO};
-        const SDLwindow window{"emunes", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ntsc_out_width, render_height};
+        const SDLwindow window{"emunes", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, render_width, render_height};
         const SDLrenderer renderer{window.handle};
-        const SDLtexture texture{renderer.handle, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, ntsc_out_width, 240};
+        const SDLtexture texture{renderer.handle, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, video->width(), video->height()};
+
+        // the emulation keeps one core, the filter gets the others, or one when the count is unknown (0).
+        // After the texture, so the workers are gone before it
+        VideoPipeline video_pipeline{*video, std::max(2u, std::thread::hardware_concurrency()) - 1};
 
-        ::SDL_RenderSetLogicalSize(renderer.handle, ntsc_out_width, render_height);
+        ::SDL_RenderSetLogicalSize(renderer.handle, render_width, render_height);
         //::SDL_SetWindowFullscreen(window.handle, SDL_WINDOW_FULLSCREEN);
 
-        if (sound_queue.init(44100))
-            throw std::runtime_error{"It's failed to initialize Sound_Queue"};
+        const SDLaudio audio{audio_ring, audio_frequency, device_samples};
+
+        // this thread only handles the events and presents the frames, so neither a slow present nor
+        // the display's refresh rate holds up the emulation; it stops before the SDL objects go
+        const auto frames = std::make_unique<TripleBuffer>();
+        Emulation emulation{console, *frames, audio_ring};
 
         SDL_Event event;
 
         bool key_states[SDL_NUM_SCANCODES]{};
+        int  sent_control = -1;
 
         for (bool running = true; running;)
         {
-            const Uint32 start_time = ::SDL_GetTicks();
-
             while (::SDL_PollEvent(&event))
             {
                 switch (event.type)
@@ -140,38 +454,27 @@ namespace
                                           key_states[SDL_SCANCODE_DOWN   ] << 5 |
                                           key_states[SDL_SCANCODE_LEFT   ] << 6 |
                                           key_states[SDL_SCANCODE_RIGHT  ] << 7;
-            controller.set_port_keys<0>(control);
+            if (control != sent_control) {emulation.set_keys(control); sent_control = control;}
 
-            cpu.run_cpu(29780);
-            apu.end_time_frame(cpu.get_cpu_time());
-            cpu.reset_cpu_time();
+            const TripleBuffer::Frame* frame = frames->newest();
+            if (!frame) {::SDL_Delay(1); continue;}
 
-            burst_phase ^= 1;
-            ::nes_ntsc_blit(&nes_ntsc, framebuffer, 256, burst_phase, 256, 240, pixel_output, ntsc_out_width * sizeof (std::uint_least16_t));
-
-            Uint32* pixels;
+            // the workers filter into the texture memory
+            void* pixels;
             int pitch;
-
-            ::SDL_LockTexture(texture.handle, nullptr, reinterpret_cast<void**>(&pixels), &pitch);
-
-            for (int i = 0; i < ntsc_out_width * 240; ++i)
-            {
-                const unsigned r = (pixel_output[i] >> 10 & 31) * 255 / 31;
-                const unsigned g = (pixel_output[i] >>  5 & 31) * 255 / 31;
-                const unsigned b = (pixel_output[i]       & 31) * 255 / 31;
-                pixels[i] = 0xFF000000 | r << 16 | g << 8 | b;
-            }
-
+            if (::SDL_LockTexture(texture.handle, nullptr, &pixels, &pitch))
+                throw std::runtime_error{::SDL_GetError()};
+            video_pipeline.submit(frame->pixels, frame->number & 1, pixels, pitch);
+            video_pipeline.wait();
             ::SDL_UnlockTexture(texture.handle);
 
             ::SDL_RenderClear(renderer.handle);
             ::SDL_RenderCopy(renderer.handle, texture.handle, nullptr, nullptr);
             ::SDL_RenderPresent(renderer.handle);
-
-            const Uint32 elapsed_time = ::SDL_GetTicks() - start_time;
-            if (elapsed_time < 1000 / 60)
-                ::SDL_Delay(   1000 / 60 - elapsed_time);
         }
+
+        std::clog << "audio overruns:      \t" << audio_ring.get_overruns()  << std::endl <<
+                     "audio underruns:     \t" << audio_ring.get_underruns() << std::endl;
     }
 }
 
@@ -179,9 +482,16 @@ int main(int argc, char** argv)
 {
     try
     {
-        if (argc != 2)
-            throw std::runtime_error{"emunes 'filepath'"};
-        ::run(argv[1]);
+        if (argc < 2 || argc > 4)
+            throw std::runtime_error{"emunes 'filepath' ['ntsc' or the pixel scale, 1 to 4] [audio latency in ms, 20 to 500]"};
+        const std::string_view video = argc >= 3 ? argv[2] : "ntsc";
+        const int scale = video == "ntsc" ? 0 : std::atoi(argv[2]);
+        if (scale < 0 || scale > 4 || (video != "ntsc" && !scale))
+            throw std::runtime_error{"the video is 'ntsc' or a pixel scale from 1 to 4"};
+        const int audio_latency = argc == 4 ? std::atoi(argv[3]) : 40;
+        if (audio_latency < 20 || audio_latency > 500)
+            throw std::runtime_error{"the audio latency is from 20 to 500 ms"};
+        ::run(argv[1], scale, audio_latency);
     }
     catch (const std::exception& ex)
     {
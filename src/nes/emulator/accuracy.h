@@ -0,0 +1,15 @@
+#ifndef ACCURACY_H
+#define ACCURACY_H
+
+namespace nes::emulator
+{
+    // The CPU and PPU run loops are compiled for both and each instance picks one:
+    // exact: every access and side effect of the hardware, as the test ROMs check it;
+    // fast:  the CPU's dummy reads of indexed addressing and the first write of read-modify-write
+    //        instructions only take their cycles when they hit plain RAM or ROM (I/O registers and
+    //        mapper writes still see them), the PPU's open bus never decays and its sprite evaluation
+    //        is done per line without the overflow bug
+    enum class Accuracy : bool {exact, fast};
+}
+
+#endif
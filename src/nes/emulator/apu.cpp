@@ -1,5 +1,9 @@
 #include "apu.h"
 
+#include "state.h"
+#include "third_party/Nes_Snd_Emu-0.1.7/nes_apu/apu_snapshot.h"
+
+#include <initializer_list>
 #include <stdexcept>
 
 using namespace nes::emulator;
@@ -9,7 +13,38 @@ APU::APU()
 	const blargg_err_t error = buffer.sample_rate(44100);
 	if (error)
         throw std::runtime_error{"APU initialization error"};
-	buffer.clock_rate(1789773);
+	buffer.clock_rate(clock_rate);
 	handle.output(&buffer);
 }
 
+
+template<class Stream>
+void APU::state(Stream& stream) noexcept
+{
+    apu_snapshot_t snapshot;
+    cpu_time_t     frame_irq_time = handle.frame_irq_time();
+    if constexpr (!Stream::loading) handle.save_snapshot(&snapshot);
+
+    stream.bytes(snapshot.w40xx, sizeof snapshot.w40xx);
+    stream.u8(snapshot.w4015); stream.u8(snapshot.w4017); stream.u16(snapshot.delay);
+    stream.u8(snapshot.step); stream.u8(snapshot.irq_flag);
+    for (auto* square : {&snapshot.square1, &snapshot.square2})
+    {
+        stream.u16(square->delay); stream.bytes(square->env, sizeof square->env);
+        stream.u8(square->length); stream.u8(square->phase); stream.u8(square->swp_delay); stream.u8(square->swp_reset);
+    }
+    stream.u16(snapshot.triangle.delay); stream.u8(snapshot.triangle.length); stream.u8(snapshot.triangle.phase);
+    stream.u8(snapshot.triangle.linear_counter); stream.u8(snapshot.triangle.linear_mode);
+    stream.u16(snapshot.noise.delay); stream.bytes(snapshot.noise.env, sizeof snapshot.noise.env);
+    stream.u8(snapshot.noise.length); stream.u16(snapshot.noise.shift_reg);
+    stream.u16(snapshot.dmc.delay); stream.u16(snapshot.dmc.remain); stream.u16(snapshot.dmc.addr);
+    stream.u8(snapshot.dmc.buf); stream.u8(snapshot.dmc.bits_remain); stream.u8(snapshot.dmc.bits);
+    stream.u8(snapshot.dmc.buf_empty); stream.u8(snapshot.dmc.silence); stream.u8(snapshot.dmc.irq_flag);
+
+    stream.u64(frame_irq_time);
+
+    if constexpr (Stream::loading) {handle.load_snapshot(snapshot); handle.frame_irq_time(frame_irq_time);}
+}
+
+template void APU::state(StateWriter&) noexcept;
+template void APU::state(StateReader&) noexcept;
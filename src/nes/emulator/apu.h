@@ -11,20 +11,26 @@ namespace nes::emulator
         Nes_Apu handle;
         blip_sample_t output_buffer[4096];
 
-        void (*output_samples)(const blip_sample_t* samples, size_t count);
+        void (*output_samples)(void* user_data, const blip_sample_t* samples, size_t count) = nullptr;
+        void* output_user_data = nullptr;
+        bool  synthesis = true;
 
     public:
+        static constexpr long clock_rate = 1789773; // NTSC CPU cycles per second
+
         APU();
 
         void end_time_frame(cpu_time_t length) noexcept
         {
             handle.end_frame(length);
+            if (!synthesis) return;
             buffer.end_frame(length);
             
-            if (buffer.samples_avail() >= 4096)
+            // all of the frame's samples (about 735), so the output adds no latency of its own
+            while (buffer.samples_avail())
             {
-                const size_t count = buffer.read_samples(output_buffer, 4096);
-                output_samples(output_buffer, count);
+                const size_t count = buffer.read_samples(output_buffer, sizeof output_buffer / sizeof *output_buffer);
+                if (output_samples) output_samples(output_user_data, output_buffer, count);
             }
         }
 
@@ -37,9 +43,28 @@ namespace nes::emulator
 
         int read_status(cpu_time_t cpu_time) noexcept {return handle.read_status(cpu_time);}
 
-        void set_output_samples(void (*output_samples)(const blip_sample_t*, size_t)) noexcept {this->output_samples = output_samples;}
+        void set_output_samples(void (*output_samples)(void*, const blip_sample_t*, size_t), void* user_data = nullptr) noexcept
+        {
+            this->output_samples = output_samples;
+            output_user_data     = user_data;
+        }
+        // Off: the channels are not synthesized and no samples are output, while the length counters, the
+        // frame IRQ and the DMC reads and IRQ stay exact; the channels' waveform positions are not kept
+        void set_synthesis(bool on) noexcept
+        {
+            if (on == synthesis) return;
+            synthesis = on;
+            if (on) buffer.clear();
+            handle.output(on ? &buffer : nullptr);
+        }
+
+        // resamples as if the CPU ran ratio times as fast
+        void set_clock_rate_ratio(double ratio) noexcept {buffer.clock_rate(static_cast<long>(clock_rate * ratio + 0.5));}
         void set_dmc_reader(int (*dmc_read)(void*, cpu_addr_t address), void* user_data = nullptr) noexcept {handle.dmc_reader(dmc_read, user_data);}
         void set_irq_changed(void (*irq_changed)(void*), void* user_data = nullptr) noexcept {handle.irq_notifier(irq_changed, user_data);}
+
+        // exact between frames only
+        template<class Stream> void state(Stream& stream) noexcept;
     };
 }
 
@@ -1,4 +1,6 @@
 #include "cartridge.h"
+#include "mapper.h"
+#include "state.h"
 
 #include <stdexcept> // std::runtime_error
 #include <fstream>   // std::ifstream
@@ -6,10 +8,32 @@
 #include <cstring>   // std::strcmp
 #include <algorithm> // std::copy_n
 #include <iterator>  // std::back_inserter
-#include <iostream>  // std::clog
 
 using namespace nes::emulator;
 
+Cartridge::Cartridge(Data&& data) : data{std::move(data)}, chr_rows(2 * this->data.vmem.size())
+{
+    for (u32 offset = 0; offset < this->data.vmem.size(); ++offset) decode_chr_row(offset);
+
+    // FNV-1a
+    rom_id = 0x811C9DC5;
+    const auto hash = [this](unsigned byte) noexcept {rom_id = (rom_id ^ byte) * 0x01000193;};
+    hash(this->data.mapper); hash(this->data.rom16_banks); hash(this->data.vrom8_banks);
+    for (const auto byte : this->data.rom) hash(byte);
+    if (this->data.vrom8_banks) for (const auto byte : this->data.vmem) hash(byte);
+
+    switch (this->data.mapper)
+    {
+        case 0: use_mapper<0>(); break;
+        case 1: use_mapper<1>(); break;
+        case 2: use_mapper<2>(); break;
+        case 3: use_mapper<3>(); break;
+        case 4: use_mapper<4>(); break;
+        case 7: use_mapper<7>(); break;
+        default: throw std::runtime_error{"the mapper is not supported yet; supported mappers: 0,1,2,3,4,7"};
+    }
+}
+
 Cartridge Cartridge::load(std::string_view filepath)
 {
     std::ifstream stream{filepath.data(), std::ios::binary | std::ios::in};
@@ -22,23 +46,45 @@ Cartridge Cartridge::load(std::string_view filepath)
     }
     const unsigned char  rom16_banks = stream.get(),  vrom8_banks = stream.get();
     const unsigned char control_byte = stream.get(), mapper_index = stream.get() | control_byte >> 4;
-    std::clog << "PRG ROM size in 16KB:\t" << (int)  rom16_banks << std::endl <<
-                 "CHR ROM size in  8KB:\t" << (int)  vrom8_banks << std::endl <<
-                 "mapper index:        \t" << (int) mapper_index << std::endl <<
-                 "control byte:        \t" << (int) control_byte << std::endl;
-    const bool mapper_supported = mapper_index == 0 || mapper_index == 2 ||
-                                  mapper_index == 3 || mapper_index == 7 || mapper_index == 1;
-    if (!mapper_supported) throw std::runtime_error{"the mapper is not supported yet; supported mappers: 0,1,2,3,7"};
     for (int i = 0; i < 8; ++i) stream.get();
     const unsigned rom_size = 0x4000 * rom16_banks, vmem_size = 0x2000 * vrom8_banks;
+    {
+        const auto data_start = stream.tellg();
+        stream.seekg(0, std::ios::end);
+        if (!rom16_banks || stream.tellg() - data_start < std::streamoff{rom_size + vmem_size})
+            throw std::runtime_error{"cartridge reading error: truncated file"};
+        stream.seekg(data_start);
+    }
     std::vector<unsigned char> rom, ram(8192), vmem;  rom.reserve( rom_size);
     if (!vmem_size) vmem.resize(0x2000); else vmem.reserve(0x2000);
     std::copy_n(std::istreambuf_iterator<char>{stream},  rom_size + 1, std::back_inserter( rom));
     std::copy_n(std::istreambuf_iterator<char>{stream}, vmem_size + 1, std::back_inserter(vmem));
-    return {{std::move( rom),
-             std::move( ram),
-             std::move(vmem), rom16_banks,
-                              vrom8_banks, mapper_index,
-             static_cast<Data::Mirror>(mapper_index == 7 || mapper_index == 1 ? Data::Mirror::SINGL : control_byte & 1)}};
+    return Cartridge{{std::move( rom),
+                      std::move( ram),
+                      std::move(vmem), rom16_banks,
+                                       vrom8_banks, mapper_index,
+                      static_cast<Data::Mirror>(mapper_index == 7 || mapper_index == 1 ? Data::Mirror::SINGL : control_byte & 1)}};
+}
+
+
+template<class Stream>
+void Cartridge::state(Stream& stream) noexcept
+{
+    stream.u8(bank); stream.bytes(regs, sizeof regs); stream.flag(nt_page); stream.u8(shift_reg);
+    stream.u8(irq_latch); stream.u8(irq_counter);
+    stream.flag(irq_reload); stream.flag(irq_enabled); stream.flag(irq_line);
+    stream.flag(a12_high); stream.u64(a12_fall);
+    stream.flag(ram_readable); stream.flag(ram_writable);
+    stream.u8(data.scroll_type);
+    stream.bytes(data.ram.data(), data.ram.size());
+    if (!data.vrom8_banks) stream.bytes(data.vmem.data(), data.vmem.size()); // CHR RAM
+
+    if constexpr (Stream::loading)
+    {
+        if (!data.vrom8_banks) for (u32 offset = 0; offset < data.vmem.size(); ++offset) decode_chr_row(offset);
+        mapper_map(*this);
+    }
 }
 
+template void Cartridge::state(StateWriter&) noexcept;
+template void Cartridge::state(StateReader&) noexcept;
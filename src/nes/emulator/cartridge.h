@@ -3,13 +3,19 @@
 
 #include "int_alias.h"
 
+#include <cstdint>
 #include <string_view>
 #include <vector>
 
 namespace nes::emulator
 {
+    // the banking logic of iNES mapper `number`, see mapper.h
+    template<unsigned number> struct Mapper;
+
     class Cartridge final
     {
+        template<unsigned> friend struct Mapper;
+
         struct Data
         {
             std::vector<unsigned char>         rom;
@@ -20,113 +26,133 @@ namespace nes::emulator
             unsigned char                   mapper;
             enum Mirror {HORIZ = 0, VERTI, SINGL} scroll_type;
         } data;
-        unsigned char     bank   = 0, regs[4]{0xC, 0, 0, 0};
+        unsigned char     bank   = 0, regs[8]{0xC, 0, 0, 0};
         bool           nt_page   = 0;
 
         u8 shift_reg = 16;
 
-        Cartridge(Data&& data) noexcept : data{std::move(data)} {}
+        // the scanline counter clocked by filtered rises of the PPU address line A12
+        unsigned char irq_latch = 0, irq_counter = 0;
+        bool irq_reload = false, irq_enabled = false, irq_line = false;
+        bool a12_high = false;
+        long a12_fall = -a12_filter;
+
+        bool ram_readable = true, ram_writable = true;
+
+        // set once by load(): the register write handler of the mapper, which remaps the windows below,
+        // and the A12 rise handler of the mappers that count them
+        void (*mapper_map)  (Cartridge& cartridge) noexcept;
+        void (*mapper_write)(Cartridge& cartridge, u16 address, u8 value) noexcept;
+        void (*mapper_a12_rise)(Cartridge& cartridge) noexcept = nullptr;
+
+        // a hash of the header numbers and the ROM contents, which tells saved states apart
+        std::uint32_t rom_id = 0;
+
+        // offsets into rom of the four 8KB windows of $8000 - $FFFF
+        u32 prg_banks[4];
+
+        // offsets into vmem of the eight 1KB windows of the PPU pattern tables
+        u32 chr_banks[8];
+
+        // offsets into the PPU RAM of the four nametables
+        u16 nt_banks[4];
+
+        // every byte of vmem pre-decoded into a row of 2-bit pixels (the plane bit in bit 0 of each pair),
+        // as is and horizontally flipped
+        std::vector<std::uint_least16_t> chr_rows;
 
-        u16 manip_chr_address(u16 address) const noexcept
+        explicit Cartridge(Data&& data);
+
+        template<unsigned number> void use_mapper() noexcept;
+
+        // bank numbers past the end of the ROM wrap around, which also mirrors a single 16KB PRG bank
+        void map_prg_8k(unsigned slot, unsigned number) noexcept {prg_banks[slot] = 0x2000 * number % (0x4000 * data.rom16_banks);}
+        void map_prg_16k(unsigned slot, unsigned number) noexcept {map_prg_8k(2 * slot, 2 * number); map_prg_8k(2 * slot + 1, 2 * number + 1);}
+        void map_prg_32k(unsigned number) noexcept {map_prg_16k(0, 2 * number); map_prg_16k(1, 2 * number + 1);}
+
+        void map_chr_1k(unsigned slot, unsigned number) noexcept
         {
-            switch (data.mapper)
-            {
-                case 3: return address + 0x2000 * bank;
-                case 1:
+            chr_banks[slot] = 0x400 * number % (data.vrom8_banks ? 0x2000 * data.vrom8_banks : 0x2000);
+        }
+        void map_chr_4k(unsigned slot, unsigned number) noexcept {for (unsigned i = 0; i < 4; ++i) map_chr_1k(4 * slot + i, 4 * number + i);}
+        void map_chr_8k(unsigned number) noexcept {map_chr_4k(0, 2 * number); map_chr_4k(1, 2 * number + 1);}
+
+        void map_nt(Data::Mirror mirror, unsigned page = 0) noexcept
+        {
+            data.scroll_type = mirror;
+            for (unsigned i = 0; i < 4; ++i)
+                switch (mirror)
                 {
-                    if (regs[0] & 16)
-                    {
-                        if (address < 0x1000) return address + 0x1000 * regs[1];
-                        else                  return address + 0x1000 * regs[2] - 0x1000;
-                    }
-                    else return address + 0x2000 * (regs[1] >> 1);
+                    case Data::HORIZ: nt_banks[i] = 0x400 * (i >> 1); break;
+                    case Data::VERTI: nt_banks[i] = 0x400 * (i &  1); break;
+                    case Data::SINGL: nt_banks[i] = 0x400 *   page;   break;
                 }
-            }
-            return address;
         }
-    public:
-        static Cartridge load(std::string_view filepath);
 
-        void write_mapper(u16 address, u8 value) noexcept
+        void decode_chr_row(u32 offset) noexcept
         {
-            switch (data.mapper)
+            const unsigned byte = data.vmem[offset];
+            unsigned row = 0, flipped = 0;
+            for (unsigned i = 0; i < 8; ++i)
             {
-                case 3: bank = value & 3;                       break;
-                case 7:                   nt_page = value & 16;
-                case 2: bank = value & 7;                       break;
-                case 1:
-                    if (value & 128) {shift_reg = 16; regs[0] |= 0xC;}
-                    else
-                    {
-                        const bool ready = shift_reg & 1;
-                        shift_reg >>= 1;
-                        shift_reg |= (value & 1) << 4;
-                        if (ready)
-                        {
-                            regs[address >> 13 & 3] = shift_reg;
-                            switch (regs[0] & 3)
-                            {
-                                case 0:
-                                case 1: data.scroll_type = Data::SINGL; break;
-                                case 2: data.scroll_type = Data::VERTI; break;
-                                case 3: data.scroll_type = Data::HORIZ; break;
-                            }
-                            shift_reg = 16;
-                        }
-                    }
-                break;
+                row     |= (byte >> (7 - i) & 1) << (14 - 2 * i);
+                flipped |= (byte >>      i  & 1) << (14 - 2 * i);
             }
+            chr_rows[2 * offset    ] = row;
+            chr_rows[2 * offset + 1] = flipped;
         }
 
-        void write_video_memory(u16 address, u8 value) noexcept {data.vmem[manip_chr_address(address)] = value;}
+        u32 manip_chr_address(u16 address) const noexcept {return chr_banks[address >> 10] + (address & 0x3FF);}
+    public:
+        // PPU dots A12 has to stay low for a rise to be counted
+        static constexpr long a12_filter = 10;
+
+        static Cartridge load(std::string_view filepath);
+
+        void write_mapper(u16 address, u8 value) noexcept {mapper_write(*this, address, value);}
+
+        void write_video_memory(u16 address, u8 value) noexcept
+        {
+            const u32 offset = manip_chr_address(address);
+            data.vmem[offset] = value;
+            decode_chr_row(offset);
+        }
         u8 read_video_memory(u16 address) const noexcept {return data.vmem[manip_chr_address(address)];}
 
-        void write_ram(u16 address, u8 value) noexcept {data.ram[address] = value;}
+        template<bool flip>
+        u16 read_pattern(u16 address) const noexcept {return chr_rows[2 * manip_chr_address(address) + flip];}
+
+        // the 8KB window i of $8000 - $FFFF and the PRG RAM (null while disabled), valid until the next write_mapper()
+        const unsigned char* prg_window(unsigned i) const noexcept {return data.rom.data() + prg_banks[i];}
+        const unsigned char* prg_ram_read() const noexcept {return ram_readable ? data.ram.data() : nullptr;}
+        unsigned char* prg_ram_write() noexcept {return ram_writable ? data.ram.data() : nullptr;}
 
-        u8 read_ram(u16 address) const noexcept {return data.ram[address];}
-        u8 read_rom(u16 address) const noexcept
+        // the PPU address line A12 at a pattern or $2006/$2007 access at PPU dot `dot`
+        bool watches_a12() const noexcept {return mapper_a12_rise;}
+        void a12(u16 address, long dot) noexcept
         {
-            switch (data.mapper)
+            if (address & 0x1000)
             {
-                case 7: return data.rom[address + 0x8000 * bank];
-                case 2:
-                    if (address < 0x4000) return data.rom[address + 0x4000 *             bank               ];
-                    else                  return data.rom[address + 0x4000 * (data.rom16_banks - 1) - 0x4000];
-                case 0:
-                case 3:
-                    return data.rom[data.rom16_banks == 1 ? address & 0x3FFF : address];
-                case 1:
-                    switch (regs[0] >> 2 & 3)
-                    {
-                        case 0:
-                        case 1:
-                            return data.rom[address + 0x8000 * ((regs[3] & 15) >> 1)];
-                        case 2:
-                            if (address < 0x4000) return data.rom[address % 0x4000];
-                            else                  return data.rom[address + 0x4000 * (regs[3] & 15) - 0x4000];
-                        case 3:
-                            if (address < 0x4000) return data.rom[address + 0x4000 * (regs[3] & 15)];
-                            else                  return data.rom[address + 0x4000 * (data.rom16_banks - 1) - 0x4000];
-                    }
+                if (!a12_high && dot - a12_fall >= a12_filter) mapper_a12_rise(*this);
+                a12_high = true;
             }
-            return data.rom[address];
+            else if (a12_high) {a12_high = false; a12_fall = dot;}
         }
 
-        u16 mirror_address(u16 address) const noexcept
+        bool irq() const noexcept {return irq_line;}
+
+        std::uint32_t id() const noexcept {return rom_id;}
+
+        template<class Stream> void state(Stream& stream) noexcept;
+
+        // the A12 rises it takes at least to raise the IRQ line, 0 if it cannot be raised that way
+        unsigned irq_rises_left() const noexcept
         {
-            switch (data.scroll_type)
-            {
-                case Data::HORIZ: return ((address /     2) & 0x400) + (address % 0x400);
-                case Data::VERTI: return   address % 0x800;
-                case Data::SINGL:
-                    switch (data.mapper)
-                    {
-                        case 7: return (address % 0x400) + 0x400 * nt_page;
-                        case 1: return (address % 0x400) + 0x400 * (regs[0] & 1);
-                    }
-            }
-            return address;
+            if (!irq_enabled || irq_line) return 0;
+            return irq_reload || !irq_counter ? irq_latch + 1 : irq_counter;
         }
+
+        u16 mirror_address(u16 address) const noexcept {return nt_banks[address >> 10 & 3] + (address & 0x3FF);}
     };
 }
 
@@ -0,0 +1,150 @@
+#include "compositor.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COMPOSITOR_X86
+#include <immintrin.h>
+#endif
+
+using namespace nes::emulator;
+
+namespace
+{
+    using Kernel = bool (*)(const unsigned char*, const unsigned char*, const unsigned char*,
+                            unsigned char*, unsigned, unsigned, unsigned, unsigned) noexcept;
+
+    bool compose_scalar(const unsigned char* bg, const unsigned char* sprites, const unsigned char* palette,
+                        unsigned char* out, unsigned from, unsigned to, unsigned bg_start, unsigned sprite_start) noexcept
+    {
+        bool hit = false;
+        for (unsigned x = from; x < to; ++x)
+        {
+            const unsigned spr  = x >= sprite_start ? sprites[x] : 0;
+            const unsigned back = x >= bg_start     ? bg[x]      : 0;
+            const bool spr_opaque = spr & SPRITE_LINE_PATTERN, bg_opaque = back & 3;
+
+            if (spr_opaque && bg_opaque && (spr & SPRITE_LINE_ZERO) && x != 255) hit = true;
+
+            // neither a sprite pixel nor a background one can hit the $3F10/$3F14/$3F18/$3F1C mirrors
+            if      (spr_opaque && !((spr & SPRITE_LINE_BEHIND) && bg_opaque)) out[x] = palette[0x10 | (spr & 0x0F)];
+            else if (bg_opaque)                                                out[x] = palette[back];
+            else                                                               out[x] = palette[0];
+        }
+        return hit;
+    }
+
+#ifdef COMPOSITOR_X86
+    // 16 pixels at a time; SSE2 has no byte shuffle, so the palette lookup stays scalar
+    __attribute__((target("sse2")))
+    bool compose_sse2(const unsigned char* bg, const unsigned char* sprites, const unsigned char* palette,
+                      unsigned char* out, unsigned from, unsigned to, unsigned bg_start, unsigned sprite_start) noexcept
+    {
+        const __m128i zero = _mm_setzero_si128(), ones = _mm_cmpeq_epi8(zero, zero);
+        const __m128i pattern = _mm_set1_epi8(SPRITE_LINE_PATTERN), behind = _mm_set1_epi8(SPRITE_LINE_BEHIND);
+        const __m128i sprite_zero = _mm_set1_epi8(SPRITE_LINE_ZERO), color = _mm_set1_epi8(0x0F);
+        const __m128i sprite_half = _mm_set1_epi8(0x10), last = _mm_set1_epi8(static_cast<char>(255));
+        const __m128i lane = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        const __m128i bg_first  = _mm_set1_epi8(static_cast<char>(bg_start     < 256 ? bg_start     : 0));
+        const __m128i spr_first = _mm_set1_epi8(static_cast<char>(sprite_start < 256 ? sprite_start : 0));
+        const __m128i bg_on = bg_start < 256 ? ones : zero, spr_on = sprite_start < 256 ? ones : zero;
+
+        __m128i hit = zero;
+        alignas(16) unsigned char index[16];
+        unsigned x = from;
+        for (; x + 16 <= to; x += 16)
+        {
+            const __m128i xs = _mm_add_epi8(_mm_set1_epi8(static_cast<char>(x)), lane);
+            const __m128i bg_vis  = _mm_and_si128(bg_on,  _mm_cmpeq_epi8(_mm_max_epu8(xs, bg_first),  xs));
+            const __m128i spr_vis = _mm_and_si128(spr_on, _mm_cmpeq_epi8(_mm_max_epu8(xs, spr_first), xs));
+
+            const __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bg + x)),      bg_vis);
+            const __m128i s = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sprites + x)), spr_vis);
+
+            const __m128i bg_clear  = _mm_cmpeq_epi8(_mm_and_si128(b, pattern), zero);
+            const __m128i spr_clear = _mm_cmpeq_epi8(_mm_and_si128(s, pattern), zero);
+            const __m128i spr_back  = _mm_cmpeq_epi8(_mm_and_si128(s, behind), behind);
+            const __m128i spr_zero  = _mm_cmpeq_epi8(_mm_and_si128(s, sprite_zero), sprite_zero);
+
+            hit = _mm_or_si128(hit, _mm_andnot_si128(_mm_or_si128(_mm_or_si128(bg_clear, spr_clear),
+                                                                   _mm_cmpeq_epi8(xs, last)), spr_zero));
+
+            const __m128i spr_loses = _mm_or_si128(spr_clear, _mm_andnot_si128(bg_clear, spr_back));
+            const __m128i spr_index = _mm_or_si128(_mm_and_si128(s, color), sprite_half);
+            const __m128i bg_index  = _mm_andnot_si128(bg_clear, b);
+            _mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_or_si128(_mm_andnot_si128(spr_loses, spr_index),
+                                                                            _mm_and_si128(spr_loses, bg_index)));
+            for (unsigned i = 0; i < 16; ++i) out[x + i] = palette[index[i]];
+        }
+        const bool tail_hit = compose_scalar(bg, sprites, palette, out, x, to, bg_start, sprite_start);
+        return _mm_movemask_epi8(hit) || tail_hit;
+    }
+
+    // 32 pixels at a time, the palette lookup done with two in-lane byte shuffles
+    __attribute__((target("avx2")))
+    bool compose_avx2(const unsigned char* bg, const unsigned char* sprites, const unsigned char* palette,
+                      unsigned char* out, unsigned from, unsigned to, unsigned bg_start, unsigned sprite_start) noexcept
+    {
+        const __m256i zero = _mm256_setzero_si256(), ones = _mm256_cmpeq_epi8(zero, zero);
+        const __m256i pattern = _mm256_set1_epi8(SPRITE_LINE_PATTERN), behind = _mm256_set1_epi8(SPRITE_LINE_BEHIND);
+        const __m256i sprite_zero = _mm256_set1_epi8(SPRITE_LINE_ZERO), color = _mm256_set1_epi8(0x0F);
+        const __m256i sprite_half = _mm256_set1_epi8(0x10), last = _mm256_set1_epi8(static_cast<char>(255));
+        const __m256i lane = _mm256_setr_epi8( 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+                                              16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+        const __m256i bg_first  = _mm256_set1_epi8(static_cast<char>(bg_start     < 256 ? bg_start     : 0));
+        const __m256i spr_first = _mm256_set1_epi8(static_cast<char>(sprite_start < 256 ? sprite_start : 0));
+        const __m256i bg_on = bg_start < 256 ? ones : zero, spr_on = sprite_start < 256 ? ones : zero;
+
+        const __m256i palette_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(palette)));
+        const __m256i palette_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(palette + 16)));
+
+        __m256i hit = zero;
+        unsigned x = from;
+        for (; x + 32 <= to; x += 32)
+        {
+            const __m256i xs = _mm256_add_epi8(_mm256_set1_epi8(static_cast<char>(x)), lane);
+            const __m256i bg_vis  = _mm256_and_si256(bg_on,  _mm256_cmpeq_epi8(_mm256_max_epu8(xs, bg_first),  xs));
+            const __m256i spr_vis = _mm256_and_si256(spr_on, _mm256_cmpeq_epi8(_mm256_max_epu8(xs, spr_first), xs));
+
+            const __m256i b = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bg + x)),      bg_vis);
+            const __m256i s = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sprites + x)), spr_vis);
+
+            const __m256i bg_clear  = _mm256_cmpeq_epi8(_mm256_and_si256(b, pattern), zero);
+            const __m256i spr_clear = _mm256_cmpeq_epi8(_mm256_and_si256(s, pattern), zero);
+            const __m256i spr_back  = _mm256_cmpeq_epi8(_mm256_and_si256(s, behind), behind);
+            const __m256i spr_zero  = _mm256_cmpeq_epi8(_mm256_and_si256(s, sprite_zero), sprite_zero);
+
+            hit = _mm256_or_si256(hit, _mm256_andnot_si256(_mm256_or_si256(_mm256_or_si256(bg_clear, spr_clear),
+                                                                           _mm256_cmpeq_epi8(xs, last)), spr_zero));
+
+            const __m256i spr_loses = _mm256_or_si256(spr_clear, _mm256_andnot_si256(bg_clear, spr_back));
+            const __m256i spr_index = _mm256_or_si256(_mm256_and_si256(s, color), sprite_half);
+            const __m256i bg_index  = _mm256_andnot_si256(bg_clear, b);
+            const __m256i index     = _mm256_blendv_epi8(spr_index, bg_index, spr_loses);
+
+            const __m256i high = _mm256_cmpeq_epi8(_mm256_and_si256(index, sprite_half), sprite_half);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x),
+                                _mm256_blendv_epi8(_mm256_shuffle_epi8(palette_lo, index),
+                                                   _mm256_shuffle_epi8(palette_hi, index), high));
+        }
+        const bool tail_hit = compose_scalar(bg, sprites, palette, out, x, to, bg_start, sprite_start);
+        return _mm256_movemask_epi8(hit) || tail_hit;
+    }
+#endif
+
+    Kernel select_kernel() noexcept
+    {
+#ifdef COMPOSITOR_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return compose_avx2;
+        if (__builtin_cpu_supports("sse2")) return compose_sse2;
+#endif
+        return compose_scalar;
+    }
+
+    const Kernel kernel = select_kernel();
+}
+
+bool nes::emulator::compose_scanline(const unsigned char* bg, const unsigned char* sprites, const unsigned char* palette,
+                                     unsigned char* out, unsigned from, unsigned to, unsigned bg_start, unsigned sprite_start) noexcept
+{
+    return kernel(bg, sprites, palette, out, from, to, bg_start, sprite_start);
+}
@@ -0,0 +1,23 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include "int_alias.h"
+
+namespace nes::emulator
+{
+    // a sprite line entry: the first opaque sprite pixel covering that x
+    enum SpriteLineMasks : u8 {
+        SPRITE_LINE_PATTERN = 0b00000011,
+        SPRITE_LINE_PALETTE = 0b00001100,
+        SPRITE_LINE_BEHIND  = 0b00100000, // behind the background
+        SPRITE_LINE_ZERO    = 0b01000000  // the pixel belongs to sprite 0
+    };
+
+    // Merges the pixels [from, to) of a background line (attribute << 2 | pattern) and a sprite line
+    // into palette colors. The background is visible from bg_start on and the sprites from sprite_start
+    // on (256 - hidden). Returns whether sprite 0 hit an opaque background pixel.
+    bool compose_scanline(const unsigned char* bg, const unsigned char* sprites, const unsigned char* palette,
+                          unsigned char* out, unsigned from, unsigned to, unsigned bg_start, unsigned sprite_start) noexcept;
+}
+
+#endif
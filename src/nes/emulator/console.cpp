@@ -0,0 +1,39 @@
+#include "console.h"
+
+using namespace nes::emulator;
+
+namespace
+{
+    int dmc_read(void* user_data, cpu_addr_t address) noexcept {return static_cast<CPU*>(user_data)->dmc_read(user_data, address);}
+}
+
+Console::Console(std::string_view filepath) : cartridge{Cartridge::load(filepath)}
+{
+    CPU::MemPointers mem_pointers;
+    mem_pointers.ppu            = &ppu;
+    mem_pointers.apu            = &apu;
+    mem_pointers.cartridge      = &cartridge;
+    mem_pointers.controller     = &controller;
+    cpu.set_mem_pointers(mem_pointers);
+
+    PPU::MemPointers mem_pointers_ppu;
+    mem_pointers_ppu.cartridge      = &cartridge;
+    mem_pointers_ppu.cpu            = &cpu;
+    ppu.set_mem_pointers(mem_pointers_ppu);
+
+    apu.set_dmc_reader(::dmc_read, &cpu);
+
+    ppu.set_pixel_output(framebuffer);
+
+    controller.set_port_keys<0>(0);
+    controller.set_port_keys<1>(0);
+}
+
+cpu_time_t Console::run_frame() noexcept
+{
+    cpu.run_cpu(29780);
+    const cpu_time_t length = cpu.get_cpu_time();
+    apu.end_time_frame(length);
+    cpu.reset_cpu_time();
+    return length;
+}
@@ -0,0 +1,71 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "cartridge.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "controller.h"
+#include "recompiler.h"
+#include "state.h"
+
+namespace nes::emulator
+{
+    // A whole machine with its cartridge. It holds no global state, so any number of consoles can
+    // run side by side, each one on a single thread at a time
+    class Console final
+    {
+        // value-initialized: no instance starts from leftover memory
+        Cartridge  cartridge;
+        CPU        cpu{};
+        PPU        ppu{};
+        APU        apu;
+        Controller controller{};
+
+        unsigned char framebuffer[256 * 240]{};
+
+    public:
+        // throws std::runtime_error if the ROM cannot be loaded
+        explicit Console(std::string_view filepath);
+
+        // the components point to each other
+        Console(const Console&) = delete;
+        Console& operator=(const Console&) = delete;
+
+        // Runs until the end of the next frame and returns its length in CPU cycles.
+        // The framebuffer holds the frame afterwards
+        cpu_time_t run_frame() noexcept;
+
+        // the buttons, bit 0 to 7: A, B, Select, Start, Up, Down, Left, Right
+        template<bool port>
+        void set_port_keys(unsigned char keys) noexcept {controller.set_port_keys<port>(keys);}
+
+        // called with the samples of every frame (44100 Hz, mono) from run_frame()
+        void set_audio_output(void (*output)(void* user_data, const blip_sample_t* samples, size_t count), void* user_data = nullptr) noexcept
+        {
+            apu.set_output_samples(output, user_data);
+        }
+        // Fewer samples per frame above 1, more below (1 by default), for a front end keeping its audio
+        // queue level against the device's clock; a fraction of a percent is not heard
+        void set_audio_rate(double ratio) noexcept {apu.set_clock_rate_ratio(ratio);}
+        // on by default; off: no samples and less work, the same emulation otherwise
+        void set_audio_synthesis(bool on) noexcept {apu.set_synthesis(on);}
+
+        // exact by default; see Accuracy
+        void set_accuracy(Accuracy accuracy) noexcept {cpu.set_accuracy(accuracy); ppu.set_accuracy(accuracy);}
+
+        // idle loops (JMP *, polling $2002) skipped to the next event; on by default, the same emulation
+        void set_idle_loop_skipping(bool skip) noexcept {cpu.set_idle_loop_skipping(skip);}
+
+        // null: interpreter only; the recompiler must outlive its use and serve this console only
+        void set_recompiler(Recompiler* recompiler) noexcept {cpu.set_recompiler(recompiler);}
+
+        // 256x240 palette indices
+        const unsigned char* get_framebuffer() const noexcept {return framebuffer;}
+
+        // for save_state(), load_state() and Rewind
+        Machine machine() noexcept {return {&cpu, &ppu, &apu, &cartridge, &controller};}
+    };
+}
+
+#endif
@@ -47,6 +47,13 @@ namespace nes::emulator
             if constexpr (port) port_2_buf = keys;
             else                port_1_buf = keys;
         }
+
+        template<class Stream>
+        void state(Stream& stream) noexcept
+        {
+            stream.u8(port_1); stream.u8(port_2); stream.u8(port_1_buf); stream.u8(port_2_buf);
+            stream.flag(strobe);
+        }
     };
 }
 
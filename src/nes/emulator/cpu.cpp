@@ -4,34 +4,120 @@
 #include "ppu.h"
 #include "apu.h"
 #include "controller.h"
+#include "recompiler.h"
+#include "state.h"
+
+#include <algorithm> // std::min
 
 using namespace nes::emulator;
 
 void CPU::poll_int() noexcept
 {
+    sync_ppu_events();
          if (nmi) {pending_interrupt = NMI; nmi = false;}
     else if (!(P & MI))
     {
-        if (cpu_time >= mem_pointers.apu->earliest_irq() - 1)
+        if (cpu_time >= mem_pointers.apu->earliest_irq() - 1 || mem_pointers.cartridge->irq())
             pending_interrupt = IRQ;
     }
 }
 
-void CPU::sync_hardware() noexcept
+void CPU::skip_idle_loop(cpu_time_t end_time, unsigned period, unsigned last_poll, int status_read) noexcept
 {
-    for (int i = 0; i < 3; ++i) mem_pointers.ppu->tick();
-    ++cpu_time;
+    if (pending_interrupt != NuLL || nmi) return;
+
+    // the latest cycle an iteration can start at
+    cpu_time_t last_start = std::min(end_time - 1, ppu_deadline - 1 - last_poll);
+    if (!(P & MI))
+    {
+        if (mem_pointers.cartridge->irq()) return;
+        last_start = std::min(last_start, mem_pointers.apu->earliest_irq() - 2 - last_poll);
+    }
+    if (status_read >= 0)
+        last_start = std::min(last_start, ppu_sync_time + mem_pointers.ppu->ticks_to_status_change() / 3 - status_read);
+
+    if (last_start >= cpu_time) cpu_time += ((last_start - cpu_time) / period + 1) * period;
 }
 
-void CPU::wb(u16 address, u8 value) noexcept
+void CPU::skip_status_poll(cpu_time_t end_time) noexcept
 {
-    sync_hardware();
-    if      (address < 0x0800) internal_ram[address] = value; // 2KB internal RAM
-    else if (address < 0x2000) internal_ram[address - 0x0800] = value; // mirrors of $0000 - $800
-    else if (address < 0x4000)
+    const auto peek = [this](unsigned address) noexcept -> int
+    {
+        const unsigned char* page = read_pages[(address & 0xFFFF) >> 11];
+        return page ? page[address & 0x7FF] : -1;
+    };
+    // waiting for the vblank flag (which the read clears) to be set, or for the sprite 0 hit flag to
+    // change; the loads' Z depends on the open bus bits as well
+    const int op = peek(PC), branch = peek(PC + 3);
+    if (peek(PC + 1) != 0x02 || peek(PC + 2) != 0x20) return;
+    if (((op == 0xAD || op == 0xAE || op == 0xAC) && branch == 0x10) ||
+         (op == 0x2C && (branch == 0x10 || branch == 0x50 || branch == 0x70)))
+        skip_idle_loop(end_time, 7, 5, 4);
+}
+
+void CPU::sync_ppu() noexcept
+{
+    mem_pointers.ppu->run(3 * (cpu_time - ppu_sync_time));
+    ppu_sync_time = cpu_time;
+}
+
+void CPU::schedule_ppu() noexcept
+{
+    long ticks = mem_pointers.ppu->ticks_to_nmi();
+    const long irq_ticks = mem_pointers.ppu->ticks_to_a12_rises(mem_pointers.cartridge->irq_rises_left());
+    if (irq_ticks != PPU::never && (ticks == PPU::never || irq_ticks < ticks)) ticks = irq_ticks;
+    ppu_deadline = ticks == PPU::never ? Nes_Apu::no_irq : cpu_time + ticks / 3 + 1;
+}
+
+void CPU::reset_cpu_time() noexcept
+{
+    sync_ppu();
+    if (ppu_deadline != Nes_Apu::no_irq) ppu_deadline -= cpu_time;
+    ppu_sync_time = cpu_time = 0;
+}
+
+void CPU::map_memory() noexcept
+{
+    // 2KB internal RAM and its mirrors up to $2000, then the registers and the unmapped cartridge space
+    for (unsigned page = 0; page < 32; ++page)
+        read_pages[page] = write_pages[page] = page < 4 ? internal_ram : nullptr;
+    map_cartridge();
+}
+
+void CPU::map_cartridge() noexcept
+{
+    const unsigned char* ram_read  = mem_pointers.cartridge->prg_ram_read();
+    unsigned char*       ram_write = mem_pointers.cartridge->prg_ram_write();
+    for (unsigned page = 12; page < 16; ++page)
+    {
+        read_pages [page] = ram_read  ? ram_read  + (page - 12) * 0x800 : nullptr;
+        write_pages[page] = ram_write ? ram_write + (page - 12) * 0x800 : nullptr;
+    }
+    for (unsigned page = 16; page < 32; ++page)
+        read_pages[page] = mem_pointers.cartridge->prg_window(page / 4 - 4) + page % 4 * 0x800;
+}
+
+template<class Stream>
+void CPU::state(Stream& stream) noexcept
+{
+    stream.u8(A); stream.u8(X); stream.u8(Y); stream.u8(P); stream.u8(S); stream.u16(PC);
+    stream.u64(cpu_time); stream.u64(ppu_sync_time); stream.u64(ppu_deadline);
+    stream.u8(pending_interrupt);
+    stream.flag(nmi); stream.flag(irq);
+    stream.bytes(internal_ram, sizeof internal_ram);
+    if constexpr (Stream::loading) map_cartridge();
+}
+
+template void CPU::state(StateWriter&) noexcept;
+template void CPU::state(StateReader&) noexcept;
+
+void CPU::write_io(u16 address, u8 value) noexcept
+{
+    if (address < 0x4000)
     {
         // $2000 - $2008 - ppu registers
         // $2008 - $4000 - mirrors of $2000-$2007 (repeats every 8 bytes)
+        sync_ppu();
         switch (address % 8)
         {
             case 0: mem_pointers.ppu->reg_write<0>(value);  break;
@@ -43,6 +129,7 @@ void CPU::wb(u16 address, u8 value) noexcept
             case 6: mem_pointers.ppu->reg_write<6>(value);  break; // x2
             case 7: mem_pointers.ppu->reg_write<7>(value);  break;
         }
+        schedule_ppu();
     }
     else if (address < 0x4018) // apu and I/O registers
     {
@@ -55,29 +142,37 @@ void CPU::wb(u16 address, u8 value) noexcept
     }
     else if (address < 0x4020); // normally disabled
     else if (address < 0x6000); // cartridge space
-    else if (address < 0x8000) mem_pointers.cartridge->write_ram(address - 0x6000, value);
-    else mem_pointers.cartridge->write_mapper(address, value);
+    else if (address >= 0x8000)
+    {
+        sync_ppu(); // banking and mirroring changes must not affect the pixels already drawn
+        mem_pointers.cartridge->write_mapper(address, value);
+        map_cartridge();
+        schedule_ppu();
+    }
 }
 
-u8 CPU::rb(u16 address) noexcept
+u8 CPU::read_io(u16 address) noexcept
 {
-    sync_hardware();
-    if      (address < 0x0800) return internal_ram[address]; // 2KB internal RAM
-    else if (address < 0x2000) return internal_ram[address - 0x0800]; // mirror of $0-$800
-    else if (address < 0x4000)
+    if (address < 0x4000)
+    {
         // $2000 - $2008 - ppu registers
         // $2008 - $4000 - mirrors of $2000-$2007 (repeats every 8 bytes)
+        sync_ppu();
+        u8 value = 0;
         switch (address % 8)
         {
-            case  0: return mem_pointers.ppu->reg_read<0>();
-            case  1: return mem_pointers.ppu->reg_read<1>();
-            case  2: return mem_pointers.ppu->reg_read<2>();
-            case  3: return mem_pointers.ppu->reg_read<3>();
-            case  4: return mem_pointers.ppu->reg_read<4>();
-            case  5: return mem_pointers.ppu->reg_read<5>();
-            case  6: return mem_pointers.ppu->reg_read<6>();
-            case  7: return mem_pointers.ppu->reg_read<7>();
+            case  0: value = mem_pointers.ppu->reg_read<0>(); break;
+            case  1: value = mem_pointers.ppu->reg_read<1>(); break;
+            case  2: value = mem_pointers.ppu->reg_read<2>(); break;
+            case  3: value = mem_pointers.ppu->reg_read<3>(); break;
+            case  4: value = mem_pointers.ppu->reg_read<4>(); break;
+            case  5: value = mem_pointers.ppu->reg_read<5>(); break;
+            case  6: value = mem_pointers.ppu->reg_read<6>(); break;
+            case  7: value = mem_pointers.ppu->reg_read<7>(); break;
         }
+        schedule_ppu();
+        return value;
+    }
     else if (address < 0x4018) // apu and I/O registers
     {
         switch (address)
@@ -87,12 +182,7 @@ u8 CPU::rb(u16 address) noexcept
             case 0x4017: return mem_pointers.controller->read<1>();
         }
     }
-    else if (address < 0x4020) return 0; // normally disabled
-    else if (address < 0x6000) return 0;
-    else if (address < 0x8000) return mem_pointers.cartridge->read_ram(address - 0x6000);
-    else return mem_pointers.cartridge->read_rom(address - 0x8000);
-
-    return 0;
+    return 0; // normally disabled and the unmapped cartridge space
 }
 
 void CPU::oam_dma(u8 value) noexcept
@@ -104,221 +194,118 @@ void CPU::oam_dma(u8 value) noexcept
         wb(0x2004, rb(dummy_value | i));
 }
 
-void CPU::instruction() noexcept
+// Every opcode in order as X(opcode, operation, operand): its handler is the operation applied to what
+// its addressing mode computes, e.g. lda(zp()), for the run loop's accuracy. The entries past 0xFF start
+// the pending interrupt
+#define CPU_OPCODES(X) \
+    X(0x00, INT<BRK>, )           X(0x01, ora, izx())               X(0x02, unofficial, )                       X(0x03, unofficial, )  \
+    X(0x04, nop, zp())            X(0x05, ora, zp())                X(0x06, asl<accuracy>, zp())                X(0x07, unofficial, )  \
+    X(0x08, php, )                X(0x09, ora, imm())               X(0x0A, asl_a, )                            X(0x0B, unofficial, )  \
+    X(0x0C, nop, abs())           X(0x0D, ora, abs())               X(0x0E, asl<accuracy>, abs())               X(0x0F, unofficial, )  \
+    X(0x10, bpl, end_time)        X(0x11, ora, izy<accuracy>())     X(0x12, unofficial, )                       X(0x13, unofficial, )  \
+    X(0x14, nop, zpx())           X(0x15, ora, zpx())               X(0x16, asl<accuracy>, zpx())               X(0x17, unofficial, )  \
+    X(0x18, clc, )                X(0x19, ora, aby<accuracy>())     X(0x1A, nop, PC)                            X(0x1B, unofficial, )  \
+    X(0x1C, nop, abx<accuracy>()) X(0x1D, ora, abx<accuracy>())     X(0x1E, asl<accuracy>, abx_big<accuracy>()) X(0x1F, unofficial, )  \
+    X(0x20, jsr, )                X(0x21, AND, izx())               X(0x22, unofficial, )                       X(0x23, unofficial, )  \
+    X(0x24, bit, zp())            X(0x25, AND, zp())                X(0x26, rol<accuracy>, zp())                X(0x27, unofficial, )  \
+    X(0x28, plp, )                X(0x29, AND, imm())               X(0x2A, rol_a, )                            X(0x2B, unofficial, )  \
+    X(0x2C, bit, abs())           X(0x2D, AND, abs())               X(0x2E, rol<accuracy>, abs())               X(0x2F, unofficial, )  \
+    X(0x30, bmi, end_time)        X(0x31, AND, izy<accuracy>())     X(0x32, unofficial, )                       X(0x33, unofficial, )  \
+    X(0x34, nop, zpx())           X(0x35, AND, zpx())               X(0x36, rol<accuracy>, zpx())               X(0x37, unofficial, )  \
+    X(0x38, sec, )                X(0x39, AND, aby<accuracy>())     X(0x3A, nop, PC)                            X(0x3B, unofficial, )  \
+    X(0x3C, nop, abx<accuracy>()) X(0x3D, AND, abx<accuracy>())     X(0x3E, rol<accuracy>, abx_big<accuracy>()) X(0x3F, unofficial, )  \
+    X(0x40, rti, )                X(0x41, eor, izx())               X(0x42, unofficial, )                       X(0x43, unofficial, )  \
+    X(0x44, nop, zp())            X(0x45, eor, zp())                X(0x46, lsr<accuracy>, zp())                X(0x47, unofficial, )  \
+    X(0x48, pha, )                X(0x49, eor, imm())               X(0x4A, lsr_a, )                            X(0x4B, unofficial, )  \
+    X(0x4C, jmp_abs, end_time)    X(0x4D, eor, abs())               X(0x4E, lsr<accuracy>, abs())               X(0x4F, unofficial, )  \
+    X(0x50, bvc, end_time)        X(0x51, eor, izy<accuracy>())     X(0x52, unofficial, )                       X(0x53, unofficial, )  \
+    X(0x54, nop, zpx())           X(0x55, eor, zpx())               X(0x56, lsr<accuracy>, zpx())               X(0x57, unofficial, )  \
+    X(0x58, cli, )                X(0x59, eor, aby<accuracy>())     X(0x5A, nop, PC)                            X(0x5B, unofficial, )  \
+    X(0x5C, nop, abx<accuracy>()) X(0x5D, eor, abx<accuracy>())     X(0x5E, lsr<accuracy>, abx_big<accuracy>()) X(0x5F, unofficial, )  \
+    X(0x60, rts, )                X(0x61, adc<0>, izx())            X(0x62, unofficial, )                       X(0x63, unofficial, )  \
+    X(0x64, nop, zp())            X(0x65, adc<0>, zp())             X(0x66, ror<accuracy>, zp())                X(0x67, unofficial, )  \
+    X(0x68, pla, )                X(0x69, adc<0>, imm())            X(0x6A, ror_a, )                            X(0x6B, unofficial, )  \
+    X(0x6C, jmp_ind, )            X(0x6D, adc<0>, abs())            X(0x6E, ror<accuracy>, abs())               X(0x6F, unofficial, )  \
+    X(0x70, bvs, end_time)        X(0x71, adc<0>, izy<accuracy>())  X(0x72, unofficial, )                       X(0x73, unofficial, )  \
+    X(0x74, nop, zpx())           X(0x75, adc<0>, zpx())            X(0x76, ror<accuracy>, zpx())               X(0x77, unofficial, )  \
+    X(0x78, sei, )                X(0x79, adc<0>, aby<accuracy>())  X(0x7A, nop, PC)                            X(0x7B, unofficial, )  \
+    X(0x7C, nop, abx<accuracy>()) X(0x7D, adc<0>, abx<accuracy>())  X(0x7E, ror<accuracy>, abx_big<accuracy>()) X(0x7F, unofficial, )  \
+    X(0x80, nop, imm())           X(0x81, sta, izx())               X(0x82, nop, imm())                         X(0x83, unofficial, )  \
+    X(0x84, sty, zp())            X(0x85, sta, zp())                X(0x86, stx, zp())                          X(0x87, unofficial, )  \
+    X(0x88, dey, )                X(0x89, nop, imm())               X(0x8A, txa, )                              X(0x8B, unofficial, )  \
+    X(0x8C, sty, abs())           X(0x8D, sta, abs())               X(0x8E, stx, abs())                         X(0x8F, unofficial, )  \
+    X(0x90, bcc, end_time)        X(0x91, sta, izy_big<accuracy>()) X(0x92, unofficial, )                       X(0x93, unofficial, )  \
+    X(0x94, sty, zpx())           X(0x95, sta, zpx())               X(0x96, stx, zpy())                         X(0x97, unofficial, )  \
+    X(0x98, tya, )                X(0x99, sta, aby_big<accuracy>()) X(0x9A, txs, )                              X(0x9B, unofficial, )  \
+    X(0x9C, unofficial, )         X(0x9D, sta, abx_big<accuracy>()) X(0x9E, unofficial, )                       X(0x9F, unofficial, )  \
+    X(0xA0, ldy, imm())           X(0xA1, lda, izx())               X(0xA2, ldx, imm())                         X(0xA3, unofficial, )  \
+    X(0xA4, ldy, zp())            X(0xA5, lda, zp())                X(0xA6, ldx, zp())                          X(0xA7, unofficial, )  \
+    X(0xA8, tay, )                X(0xA9, lda, imm())               X(0xAA, tax, )                              X(0xAB, unofficial, )  \
+    X(0xAC, ldy, abs())           X(0xAD, lda, abs())               X(0xAE, ldx, abs())                         X(0xAF, unofficial, )  \
+    X(0xB0, bcs, end_time)        X(0xB1, lda, izy<accuracy>())     X(0xB2, unofficial, )                       X(0xB3, unofficial, )  \
+    X(0xB4, ldy, zpx())           X(0xB5, lda, zpx())               X(0xB6, ldx, zpy())                         X(0xB7, unofficial, )  \
+    X(0xB8, clv, )                X(0xB9, lda, aby<accuracy>())     X(0xBA, tsx, )                              X(0xBB, unofficial, )  \
+    X(0xBC, ldy, abx<accuracy>()) X(0xBD, lda, abx<accuracy>())     X(0xBE, ldx, aby<accuracy>())               X(0xBF, unofficial, )  \
+    X(0xC0, cpy, imm())           X(0xC1, cmp, izx())               X(0xC2, nop, imm())                         X(0xC3, unofficial, )  \
+    X(0xC4, cpy, zp())            X(0xC5, cmp, zp())                X(0xC6, dec<accuracy>, zp())                X(0xC7, unofficial, )  \
+    X(0xC8, iny, )                X(0xC9, cmp, imm())               X(0xCA, dex, )                              X(0xCB, unofficial, )  \
+    X(0xCC, cpy, abs())           X(0xCD, cmp, abs())               X(0xCE, dec<accuracy>, abs())               X(0xCF, unofficial, )  \
+    X(0xD0, bne, end_time)        X(0xD1, cmp, izy<accuracy>())     X(0xD2, unofficial, )                       X(0xD3, unofficial, )  \
+    X(0xD4, nop, zpx())           X(0xD5, cmp, zpx())               X(0xD6, dec<accuracy>, zpx())               X(0xD7, unofficial, )  \
+    X(0xD8, cld, )                X(0xD9, cmp, aby<accuracy>())     X(0xDA, nop, PC)                            X(0xDB, unofficial, )  \
+    X(0xDC, nop, abx<accuracy>()) X(0xDD, cmp, abx<accuracy>())     X(0xDE, dec<accuracy>, abx_big<accuracy>()) X(0xDF, unofficial, )  \
+    X(0xE0, cpx, imm())           X(0xE1, adc<1>, izx())            X(0xE2, nop, imm())                         X(0xE3, unofficial, )  \
+    X(0xE4, cpx, zp())            X(0xE5, adc<1>, zp())             X(0xE6, inc<accuracy>, zp())                X(0xE7, unofficial, )  \
+    X(0xE8, inx, )                X(0xE9, adc<1>, imm())            X(0xEA, nop, PC)                            X(0xEB, adc<1>, imm()) \
+    X(0xEC, cpx, abs())           X(0xED, adc<1>, abs())            X(0xEE, inc<accuracy>, abs())               X(0xEF, unofficial, )  \
+    X(0xF0, beq, end_time)        X(0xF1, adc<1>, izy<accuracy>())  X(0xF2, unofficial, )                       X(0xF3, unofficial, )  \
+    X(0xF4, nop, zpx())           X(0xF5, adc<1>, zpx())            X(0xF6, inc<accuracy>, zpx())               X(0xF7, unofficial, )  \
+    X(0xF8, sed, )                X(0xF9, adc<1>, aby<accuracy>())  X(0xFA, nop, PC)                            X(0xFB, unofficial, )  \
+    X(0xFC, nop, abx<accuracy>()) X(0xFD, adc<1>, abx<accuracy>())  X(0xFE, inc<accuracy>, abx_big<accuracy>()) X(0xFF, unofficial, )  \
+    X(0x100, INT<NMI>, )          X(0x101, INT<RST>, )              X(0x102, INT<IRQ>, )
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // labels as values
+#endif
+
+void CPU::run_cpu_until(cpu_time_t end_time) noexcept
 {
-    /*opcode fetch*/u16 op = rb(PC++); PC &= 0xFFFF;
-
-    switch (const u16 i = pending_interrupt; i)
-    {
-        case RST: op = 0x100; break;
-        case NMI: op = 0x101; break;
-        case IRQ: op = 0x102; break;
-    }
+    if (accuracy == Accuracy::exact) run_instructions<Accuracy::exact>(end_time);
+    else                             run_instructions<Accuracy::fast >(end_time);
+}
 
-    switch (op)
+template<Accuracy accuracy>
+void CPU::run_instructions(cpu_time_t end_time) noexcept
+{
+#if defined(__GNUC__)
+    // threaded code: every handler ends with its own dispatch of the next one, which the branch
+    // predictor learns per opcode instead of through a single shared jump
+    #define CPU_LABEL(code, operation, operand) &&op_##code,
+    static const void* const handlers[]{CPU_OPCODES(CPU_LABEL)};
+    #undef CPU_LABEL
+
+    #define CPU_DISPATCH() if (recompiler) recompiler->run(*this, end_time); if (cpu_time >= end_time) return; goto *handlers[fetch()]
+    CPU_DISPATCH();
+    #define CPU_HANDLER(code, operation, operand) op_##code: operation(operand); CPU_DISPATCH();
+    CPU_OPCODES(CPU_HANDLER)
+    #undef CPU_HANDLER
+    #undef CPU_DISPATCH
+#else
+    #define CPU_CASE(code, operation, operand) case code: operation(operand); break;
+    for (;;)
     {
-        case 0xA5: lda(zp()); break;
-        case 0xA6: ldx(zp()); break;
-        case 0xA4: ldy(zp()); break;
-        case 0x04: nop(zp()); break;
-        case 0x44: nop(zp()); break;
-        case 0x64: nop(zp()); break;
-        case 0x05: ora(zp()); break;
-        case 0x65: adc<0>(zp()); break;
-        case 0xE5: adc<1>(zp()); break;
-        case 0x25: AND(zp()); break;
-        case 0x24: bit(zp()); break;
-        case 0xC5: cmp(zp()); break;
-        case 0xE4: cpx(zp()); break;
-        case 0xC4: cpy(zp()); break;
-        case 0x45: eor(zp()); break;
-        case 0x85: sta(zp()); break;
-        case 0x86: stx(zp()); break;
-        case 0x84: sty(zp()); break;
-        case 0x46: lsr(zp()); break;
-        case 0x26: rol(zp()); break;
-        case 0x66: ror(zp()); break;
-        case 0x06: asl(zp()); break;
-        case 0xC6: dec(zp()); break;
-        case 0xE6: inc(zp()); break;
-
-        case 0xB5: lda(zpx()); break;
-        case 0xB6: ldx(zpy()); break;
-        case 0xB4: ldy(zpx()); break;
-
-        case 0x14: nop(zpx()); break;
-        case 0x34: nop(zpx()); break;
-        case 0x54: nop(zpx()); break;
-        case 0x74: nop(zpx()); break;
-        case 0xD4: nop(zpx()); break;
-        case 0xF4: nop(zpx()); break;
-        case 0x15: ora(zpx()); break;
-        case 0x75: adc<0>(zpx()); break;
-        case 0xF5: adc<1>(zpx()); break;
-        case 0x35: AND(zpx()); break;
-        case 0xD5: cmp(zpx()); break;
-        case 0x55: eor(zpx()); break;
-        case 0x95: sta(zpx()); break;
-        case 0x96: stx(zpy()); break;
-        case 0x94: sty(zpx()); break;
-
-        case 0x56: lsr(zpx()); break;
-        case 0x36: rol(zpx()); break;
-        case 0x76: ror(zpx()); break;
-        case 0x16: asl(zpx()); break;
-        case 0xD6: dec(zpx()); break;
-        case 0xF6: inc(zpx()); break;
-
-        case 0xAD: lda(abs()); break;
-        case 0xAE: ldx(abs()); break;
-        case 0xAC: ldy(abs()); break;
-        case 0x0C: nop(abs()); break;
-        case 0x0D: ora(abs()); break;
-        case 0x6D: adc<0>(abs()); break;
-        case 0xED: adc<1>(abs()); break;
-        case 0x2D: AND(abs()); break;
-        case 0x2C: bit(abs()); break;
-        case 0xCD: cmp(abs()); break;
-        case 0xEC: cpx(abs()); break;
-        case 0xCC: cpy(abs()); break;
-        case 0x4D: eor(abs()); break;
-        case 0x8D: sta(abs()); break;
-        case 0x8E: stx(abs()); break;
-        case 0x8C: sty(abs()); break;
-
-        case 0x4E: lsr(abs()); break;
-        case 0x2E: rol(abs()); break;
-        case 0x6E: ror(abs()); break;
-        case 0x0E: asl(abs()); break;
-        case 0xCE: dec(abs()); break;
-        case 0xEE: inc(abs()); break;
-
-        case 0xBD: lda(abx()); break;
-        case 0xB9: lda(aby()); break;
-        case 0xBE: ldx(aby()); break;
-        case 0xBC: ldy(abx()); break;
-        case 0x1C: nop(abx()); break;
-        case 0x3C: nop(abx()); break;
-        case 0x5C: nop(abx()); break;
-        case 0x7C: nop(abx()); break;
-        case 0xDC: nop(abx()); break;
-        case 0xFC: nop(abx()); break;
-        case 0x1D: ora(abx()); break;
-        case 0x19: ora(aby()); break;
-        case 0x7D: adc<0>(abx()); break;
-        case 0x79: adc<0>(aby()); break;
-        case 0xFD: adc<1>(abx()); break;
-        case 0xF9: adc<1>(aby()); break;
-        case 0x3D: AND(abx()); break;
-        case 0x39: AND(aby()); break;
-        case 0xDD: cmp(abx()); break;
-        case 0xD9: cmp(aby()); break;
-        case 0x5D: eor(abx()); break;
-        case 0x59: eor(aby()); break;
-
-        case 0x9D: sta(abx_big()); break;
-        case 0x99: sta(aby_big()); break;
-
-        case 0x5E: lsr(abx_big()); break;
-        case 0x3E: rol(abx_big()); break;
-        case 0x7E: ror(abx_big()); break;
-        case 0x1E: asl(abx_big()); break;
-        case 0xDE: dec(abx_big()); break;
-        case 0xFE: inc(abx_big()); break;
-
-        case 0xA1: lda(izx()); break;
-        case 0x01: ora(izx()); break;
-        case 0x61: adc<0>(izx()); break;
-        case 0xE1: adc<1>(izx()); break;
-        case 0x21: AND(izx()); break;
-        case 0xC1: cmp(izx()); break;
-        case 0x41: eor(izx()); break;
-        case 0x81: sta(izx()); break;
-
-        case 0xB1: lda(izy()); break;
-        case 0x11: ora(izy()); break;
-        case 0x71: adc<0>(izy()); break;
-        case 0xF1: adc<1>(izy()); break;
-        case 0x31: AND(izy()); break;
-        case 0xD1: cmp(izy()); break;
-        case 0x51: eor(izy()); break;
-
-        case 0x91: sta(izy_big()); break;
-
-        case 0xA9: lda(imm()); break;
-        case 0xA2: ldx(imm()); break;
-        case 0xA0: ldy(imm()); break;
-        case 0x80: nop(imm()); break;
-        case 0x82: nop(imm()); break;
-        case 0xC2: nop(imm()); break;
-        case 0xE2: nop(imm()); break;
-        case 0x89: nop(imm()); break;
-        case 0x09: ora(imm()); break;
-        case 0x69: adc<0>(imm()); break;
-        case 0xE9: adc<1>(imm()); break;
-        case 0xEB: adc<1>(imm()); break;
-        case 0x29: AND(imm()); break;
-        case 0xC9: cmp(imm()); break;
-        case 0xE0: cpx(imm()); break;
-        case 0xC0: cpy(imm()); break;
-        case 0x49: eor(imm()); break;
-
-        case 0x4A: lsr_a(); break;
-        case 0x2A: rol_a(); break;
-        case 0x6A: ror_a(); break;
-        case 0x0A: asl_a(); break;
-
-        case 0x18: clc(); break;
-        case 0xD8: cld(); break;
-        case 0xB8: clv(); break;
-        case 0x58: cli(); break;
-
-        case 0x78: sei(); break;
-        case 0x38: sec(); break;
-        case 0xF8: sed(); break;
-        case 0xCA: dex(); break;
-        case 0x88: dey(); break;
-        case 0xE8: inx(); break;
-        case 0xC8: iny(); break;
-        case 0xAA: tax(); break;
-        case 0xA8: tay(); break;
-        case 0x98: tya(); break;
-        case 0xBA: tsx(); break;
-        case 0x9A: txs(); break;
-        case 0x8A: txa(); break;
-
-        case 0x1A: nop(PC); break;
-        case 0x3A: nop(PC); break;
-        case 0x5A: nop(PC); break;
-        case 0x7A: nop(PC); break;
-        case 0xDA: nop(PC); break;
-        case 0xEA: nop(PC); break;
-        case 0xFA: nop(PC); break;
-
-        case 0x48: pha(); break;
-        case 0x08: php(); break;
-        case 0x68: pla(); break;
-        case 0x28: plp(); break;
-        case 0x40: rti(); break;
-        case 0x60: rts(); break;
-
-        case 0xB0: bcs(); break;
-        case 0x90: bcc(); break;
-        case 0xF0: beq(); break;
-        case 0xD0: bne(); break;
-        case 0x30: bmi(); break;
-        case 0x10: bpl(); break;
-        case 0x70: bvs(); break;
-        case 0x50: bvc(); break;
-
-        case 0x4C: jmp_abs(); break;
-        case 0x6C: jmp_ind(); break;
-        case 0x20:     jsr(); break;
-
-        case 0x000: INT<BRK>(); break;
-        case 0x100: INT<RST>(); break;
-        case 0x101: INT<NMI>(); break;
-        case 0x102: INT<IRQ>(); break;
+        if (recompiler) recompiler->run(*this, end_time);
+        if (cpu_time >= end_time) return;
+        switch (fetch())
+        {
+            CPU_OPCODES(CPU_CASE)
+        }
     }
+    #undef CPU_CASE
+#endif
 }
 
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
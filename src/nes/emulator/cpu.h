@@ -1,6 +1,7 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include "accuracy.h"
 #include "int_alias.h"
 
 #include "third_party/Nes_Snd_Emu-0.1.7/nes_apu/Nes_Apu.h"
@@ -11,9 +12,12 @@ namespace nes::emulator
     class PPU;
     class APU;
     class Controller;
+    class Recompiler;
 
     class CPU final
     {
+        friend class Recompiler;
+
     public:
         struct MemPointers
         {
@@ -39,19 +43,55 @@ namespace nes::emulator
 
         unsigned char internal_ram[0x800];
 
+        // the 2KB pages of the address space that are plain memory; null pages go through
+        // read_io()/write_io(). The cartridge pages follow its banking (map_cartridge())
+        const unsigned char* read_pages[32];
+        unsigned char*      write_pages[32];
+
         u8   A = 0,  X = 0, Y = 0, P = 0, S = 0;
         u16 PC = 0;
 
         cpu_time_t cpu_time = 0;
 
+        // the PPU runs lazily: it has been emulated up to ppu_sync_time and must be caught up
+        // before anything observable happens, at the latest by ppu_deadline (the earliest cycle
+        // at which it could raise an NMI or make the mapper raise an IRQ)
+        cpu_time_t ppu_sync_time = 0, ppu_deadline = 0;
+
         InterruptType pending_interrupt = RST;
 
         bool nmi = false, irq = false;
 
-        void sync_hardware() noexcept;
+        Recompiler* recompiler = nullptr;
+
+        bool skip_idle_loops = true;
+
+        Accuracy accuracy = Accuracy::exact;
+
+        void sync_hardware() noexcept {++cpu_time;}
+
+        void sync_ppu() noexcept;
+        void schedule_ppu() noexcept;
+        void sync_ppu_events() noexcept {if (cpu_time >= ppu_deadline) {sync_ppu(); schedule_ppu();}}
 
-        void wb(u16 address, u8 value) noexcept;
-        u8   rb(u16 address) noexcept;
+        void map_memory() noexcept;
+        void map_cartridge() noexcept;
+
+        void write_io(u16 address, u8 value) noexcept;
+        u8   read_io(u16 address) noexcept;
+
+        void wb(u16 address, u8 value) noexcept
+        {
+            sync_hardware();
+            if (unsigned char* page = write_pages[address >> 11]) page[address & 0x7FF] = value;
+            else                                                  write_io(address, value);
+        }
+        u8 rb(u16 address) noexcept
+        {
+            sync_hardware();
+            if (const unsigned char* page = read_pages[address >> 11]) return page[address & 0x7FF];
+            return read_io(address);
+        }
 
         void push(u8 v) noexcept {wb(0x100 | S--, v); S &= 255;}
         u8 pop() noexcept {++S &= 255; return rb(0x100 | S);}
@@ -68,20 +108,38 @@ namespace nes::emulator
 
         void poll_int() noexcept;
 
+        // accesses whose value the instruction discards; fast skips them only where they are plain memory
+        template<Accuracy accuracy>
+        void dummy_read(u16 address) noexcept
+        {
+            if (accuracy == Accuracy::fast && read_pages[address >> 11]) sync_hardware(); else rb(address);
+        }
+        template<Accuracy accuracy>
+        void dummy_write(u16 address, u8 value) noexcept
+        {
+            if (accuracy == Accuracy::fast && write_pages[address >> 11]) sync_hardware(); else wb(address, value);
+        }
+
         u16  zp() noexcept {const u16 a = rb(PC++);  PC &= 0xFFFF; return a;}
         u16 zpx() noexcept {const u16 a = zp(); rb(a); return (a + X) & 255;}
         u16 zpy() noexcept {const u16 a = zp(); rb(a); return (a + Y) & 255;}
         u16 abs() noexcept {u16 a = rb(PC++); PC &= 0xFFFF; a |= rb(PC++) << 8; PC &= 0xFFFF; return a;}
-        u16 abx() noexcept {const u16 t = abs(); u16 a = t + X; if ((a ^ t) & 256) {rb(a - 256); a &= 0xFFFF;} return a;}
-        u16 aby() noexcept {const u16 t = abs(); u16 a = t + Y; if ((a ^ t) & 256) {rb(a - 256); a &= 0xFFFF;} return a;}
+        template<Accuracy accuracy>
+        u16 abx() noexcept {const u16 t = abs(); u16 a = t + X; if ((a ^ t) & 256) {dummy_read<accuracy>(a - 256); a &= 0xFFFF;} return a;}
+        template<Accuracy accuracy>
+        u16 aby() noexcept {const u16 t = abs(); u16 a = t + Y; if ((a ^ t) & 256) {dummy_read<accuracy>(a - 256); a &= 0xFFFF;} return a;}
         u16 izx() noexcept {const u16 t = zpx(); return rb(t) |  rb((t + 1) & 255) << 8;}
-        u16 izy() noexcept {u16 t = zp(), a  = rb(t++);      t &= 255;  
+        template<Accuracy accuracy>
+        u16 izy() noexcept {u16 t = zp(), a  = rb(t++);      t &= 255;
                                           a |= rb(t  ) << 8; a +=   Y;
-                            if ((a ^ (a - Y)) & 256) {rb(a - 256); a &= 0xFFFF;} return a;}
-        u16 abx_big() noexcept {const u16 t = abs(), a = t + X; rb((a ^ t) & 256 ? a - 256 : a); return a & 0xFFFF;}
-        u16 aby_big() noexcept {const u16 t = abs(), a = t + Y; rb((a ^ t) & 256 ? a - 256 : a); return a & 0xFFFF;}
+                            if ((a ^ (a - Y)) & 256) {dummy_read<accuracy>(a - 256); a &= 0xFFFF;} return a;}
+        template<Accuracy accuracy>
+        u16 abx_big() noexcept {const u16 t = abs(), a = t + X; dummy_read<accuracy>((a ^ t) & 256 ? a - 256 : a); return a & 0xFFFF;}
+        template<Accuracy accuracy>
+        u16 aby_big() noexcept {const u16 t = abs(), a = t + Y; dummy_read<accuracy>((a ^ t) & 256 ? a - 256 : a); return a & 0xFFFF;}
+        template<Accuracy accuracy>
         u16 izy_big() noexcept {u16 t = zp(), a  = rb(t++);      t &= 255;
-                                              a |= rb(t  ) << 8; a +=   Y; rb((a ^ (a - Y)) & 256 ? a - 256 : a); return a & 0xFFFF;}
+                                              a |= rb(t  ) << 8; a +=   Y; dummy_read<accuracy>((a ^ (a - Y)) & 256 ? a - 256 : a); return a & 0xFFFF;}
         u16 imm() noexcept {const u16 t = PC++; PC &= 0xFFFF; return t;}
 
         void lda(u16 a) noexcept {poll_int(); A = rb(a); up_flag_nz(A);}
@@ -98,35 +156,39 @@ namespace nes::emulator
 
         void nop(u16 a) noexcept {poll_int(); rb(a);}
 
+        template<Accuracy accuracy>
         void lsr(u16 a) noexcept
         {
-            u8 t = rb(a); wb(a, t      ); P &= ~MC; P |= t & MC;
+            u8 t = rb(a); dummy_write<accuracy>(a, t      ); P &= ~MC; P |= t & MC;
             poll_int(); 
                           wb(a, t >>= 1);
             up_flag_nz(t);
         }
 
+        template<Accuracy accuracy>
         void asl(u16 a) noexcept
         {
-            u8 t = rb(a); wb(a,  t                 ); P &= ~MC; P |= t >> 7;
+            u8 t = rb(a); dummy_write<accuracy>(a,  t                 ); P &= ~MC; P |= t >> 7;
             poll_int();
                           wb(a, (t <<= 1, t &= 255));
             up_flag_nz(t);
         }
 
+        template<Accuracy accuracy>
         void rol(u16 a) noexcept
         {
                   u8 t =  rb(a);
-            const u8 c = t >> 7; wb(a,  t                                 );
+            const u8 c = t >> 7; dummy_write<accuracy>(a,  t                                 );
             poll_int();
                                  wb(a, (t <<= 1, t &= 255, t |= flags(MC)));
             up_flag_nz(t); P &= ~MC; P |= c;
         }
 
+        template<Accuracy accuracy>
         void ror(u16 a) noexcept
         {
                   u8 t =  rb(a);
-            const u8 c = t & MC; wb(a,  t                            );
+            const u8 c = t & MC; dummy_write<accuracy>(a,  t                            );
             poll_int();
                                  wb(a, (t >>= 1, t |= flags(MC) << 7));
             up_flag_nz(t); P &= ~MC; P |= c;
@@ -145,8 +207,10 @@ namespace nes::emulator
         void cpx(u16 a) noexcept {poll_int(); const u8 d = rb(a); up_flag_nz((X - d) & 255); P &= ~MC; P |= X >= d;}
         void cpy(u16 a) noexcept {poll_int(); const u8 d = rb(a); up_flag_nz((Y - d) & 255); P &= ~MC; P |= Y >= d;}
 
-        void dec(u16 a) noexcept {u8 t = rb(a); wb(a, t--); poll_int(); wb(a, t &= 255); up_flag_nz(t);}
-        void inc(u16 a) noexcept {u8 t = rb(a); wb(a, t++); poll_int(); wb(a, t &= 255); up_flag_nz(t);}
+        template<Accuracy accuracy>
+        void dec(u16 a) noexcept {u8 t = rb(a); dummy_write<accuracy>(a, t--); poll_int(); wb(a, t &= 255); up_flag_nz(t);}
+        template<Accuracy accuracy>
+        void inc(u16 a) noexcept {u8 t = rb(a); dummy_write<accuracy>(a, t++); poll_int(); wb(a, t &= 255); up_flag_nz(t);}
 
         template<bool inv>
         void adc(u16 a) noexcept
@@ -204,7 +268,7 @@ namespace nes::emulator
         void rti() noexcept {rb(PC); sync_hardware();  P = pop() & 0xEF;       PC = pop();      poll_int();   PC |= pop() << 8;}
         void rts() noexcept {rb(PC); sync_hardware(); PC = pop() | pop() << 8; poll_int(); sync_hardware(); ++PC &=     0xFFFF;}
 
-        void rel(bool cond) noexcept
+        void rel(bool cond, cpu_time_t end_time) noexcept
         {
             poll_int(); const u8 j = rb(PC++); PC &= 0xFFFF;
             if (cond)
@@ -215,21 +279,37 @@ namespace nes::emulator
                 {
                     poll_int(); rb((PC & 0xFF00) | (temp & 0x00FF));
                 }
+                else if (j == 0xFB && skip_idle_loops) {PC = temp & 0xFFFF; skip_status_poll(end_time); return;}
                 PC = temp & 0xFFFF;
             }
         }
 
-        void bcs() noexcept {rel( flags(MC));}
-        void bcc() noexcept {rel(!flags(MC));}
-        void beq() noexcept {rel( flags(MZ));}
-        void bne() noexcept {rel(!flags(MZ));}
-        void bmi() noexcept {rel( flags(MN));}
-        void bpl() noexcept {rel(!flags(MN));}
-        void bvs() noexcept {rel( flags(MV));}
-        void bvc() noexcept {rel(!flags(MV));}
+        void bcs(cpu_time_t end_time) noexcept {rel( flags(MC), end_time);}
+        void bcc(cpu_time_t end_time) noexcept {rel(!flags(MC), end_time);}
+        void beq(cpu_time_t end_time) noexcept {rel( flags(MZ), end_time);}
+        void bne(cpu_time_t end_time) noexcept {rel(!flags(MZ), end_time);}
+        void bmi(cpu_time_t end_time) noexcept {rel( flags(MN), end_time);}
+        void bpl(cpu_time_t end_time) noexcept {rel(!flags(MN), end_time);}
+        void bvs(cpu_time_t end_time) noexcept {rel( flags(MV), end_time);}
+        void bvc(cpu_time_t end_time) noexcept {rel(!flags(MV), end_time);}
 
         void jmp_ind() noexcept {const u16 t = abs(); PC = rb(t); poll_int(); PC |= rb((t & 0xFF00) | ((t + 1) & 0xFF)) << 8;}
-        void jmp_abs() noexcept {const u16 t = rb(PC++); PC &= 0xFFFF; poll_int(); PC = t | rb(PC) << 8;}
+        void jmp_abs(cpu_time_t end_time) noexcept
+        {
+            const u16 t = rb(PC++); PC &= 0xFFFF; poll_int();
+            const u16 from = (PC - 2) & 0xFFFF;
+            PC = t | rb(PC) << 8;
+            // JMP * waits for an interrupt: three cycles per iteration, the poll on the second
+            if (PC == from && skip_idle_loops) skip_idle_loop(end_time, 3, 2, -1);
+        }
+
+        // Idle loops: whole iterations are skipped while none of them could reach the end of the run,
+        // the PPU deadline or an interrupt, or read a different PPU status. period: the cycles of an
+        // iteration; last_poll: the cycle of its last interrupt poll; status_read: the cycle of its
+        // $2002 read, -1 if none. It starts at the current PC and cycle
+        void skip_idle_loop(cpu_time_t end_time, unsigned period, unsigned last_poll, int status_read) noexcept;
+        // after a taken branch back to the start of LDA/LDX/LDY/BIT $2002 and itself, at the start
+        void skip_status_poll(cpu_time_t end_time) noexcept;
 
         void jsr() noexcept
         {
@@ -259,6 +339,8 @@ namespace nes::emulator
             static constexpr u16 vectors[]{NuLL, 0xFFFA, 0xFFFC, 0xFFFE, 0xFFFE};
             u16 address;
 
+            if constexpr (type != NMI) sync_ppu_events();
+
             if constexpr (type == NMI) address = vectors[ NMI];
             else 
             {
@@ -276,11 +358,19 @@ namespace nes::emulator
             pending_interrupt = NuLL;
         }
 
-        void run_cpu_until(cpu_time_t end_time) noexcept
+        // the unofficial opcodes that are not emulated only take their fetch cycle
+        void unofficial() noexcept {}
+
+        // the opcode, or past it the entry of the pending interrupt: 0x100 + NMI - 1, RST, IRQ
+        unsigned fetch() noexcept
         {
-            while (cpu_time < end_time) instruction();
+            /*opcode fetch*/const unsigned op = rb(PC++); PC &= 0xFFFF;
+            return pending_interrupt ? 0xFF + pending_interrupt : op;
         }
 
+        void run_cpu_until(cpu_time_t end_time) noexcept;
+        template<Accuracy accuracy> void run_instructions(cpu_time_t end_time) noexcept;
+
         void oam_dma(u8 value) noexcept;
 
     public:
@@ -289,13 +379,20 @@ namespace nes::emulator
         int dmc_read(void*, cpu_addr_t address) noexcept {return rb(address);}
 
         void run_cpu(int cycle_count) noexcept {run_cpu_until(cpu_time + cycle_count);}
-        void reset_cpu_time() noexcept {cpu_time = 0;}
+        void reset_cpu_time() noexcept;
 
-        void set_mem_pointers(const MemPointers& mem_pointers) noexcept {this->mem_pointers = mem_pointers;}
+        void set_mem_pointers(const MemPointers& mem_pointers) noexcept {this->mem_pointers = mem_pointers; map_memory();}
         void set_nmi(bool nmi) noexcept {this->nmi = nmi;}
-        void instruction() noexcept;
+        // on by default; the emulation is the same either way
+        void set_idle_loop_skipping(bool skip) noexcept {skip_idle_loops = skip;}
+        void set_accuracy(Accuracy accuracy) noexcept {this->accuracy = accuracy;}
+        // null: interpreter only
+        void set_recompiler(Recompiler* recompiler) noexcept {this->recompiler = recompiler;}
+        void instruction() noexcept {run_cpu_until(cpu_time + 1);}
 
         cpu_time_t get_cpu_time() const noexcept {return cpu_time;}
+
+        template<class Stream> void state(Stream& stream) noexcept;
     };
 }
 
@@ -7,6 +7,7 @@ namespace nes::emulator
 {
     using u8   = std::uint_fast8_t;
     using u16  = std::uint_fast16_t;
+    using u32  = std::uint_fast32_t;
 }
 
 #endif
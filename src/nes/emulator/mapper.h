@@ -0,0 +1,162 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include "cartridge.h"
+
+namespace nes::emulator
+{
+    // every mapper maps its registers onto the cartridge windows in map() and updates them in write(),
+    // the ones with a scanline counter also clock it in a12_rise(); Cartridge::load() picks the
+    // specialization once, so no access dispatches on the mapper number
+
+    template<> struct Mapper<0> // NROM
+    {
+        static void map(Cartridge& cartridge) noexcept
+        {
+            cartridge.map_prg_32k(0);
+            cartridge.map_chr_8k(0);
+            cartridge.map_nt(cartridge.data.scroll_type);
+        }
+        static void write(Cartridge&, u16, u8) noexcept {}
+    };
+
+    template<> struct Mapper<1> // MMC1
+    {
+        static void map(Cartridge& cartridge) noexcept
+        {
+            const auto& regs = cartridge.regs;
+            switch (regs[0] >> 2 & 3)
+            {
+                case 0:
+                case 1: cartridge.map_prg_32k((regs[3] & 15) >> 1); break;
+                case 2: cartridge.map_prg_16k(0, 0); cartridge.map_prg_16k(1, regs[3] & 15);                            break;
+                case 3: cartridge.map_prg_16k(0, regs[3] & 15); cartridge.map_prg_16k(1, cartridge.data.rom16_banks - 1); break;
+            }
+            if (regs[0] & 16) {cartridge.map_chr_4k(0, regs[1]); cartridge.map_chr_4k(1, regs[2]);}
+            else               cartridge.map_chr_8k(regs[1] >> 1);
+            switch (regs[0] & 3)
+            {
+                case 0:
+                case 1: cartridge.map_nt(Cartridge::Data::SINGL, regs[0] & 1); break;
+                case 2: cartridge.map_nt(Cartridge::Data::VERTI);              break;
+                case 3: cartridge.map_nt(Cartridge::Data::HORIZ);              break;
+            }
+        }
+        static void write(Cartridge& cartridge, u16 address, u8 value) noexcept
+        {
+            if (value & 128) {cartridge.shift_reg = 16; cartridge.regs[0] |= 0xC;}
+            else
+            {
+                const bool ready = cartridge.shift_reg & 1;
+                cartridge.shift_reg >>= 1;
+                cartridge.shift_reg |= (value & 1) << 4;
+                if (ready)
+                {
+                    cartridge.regs[address >> 13 & 3] = cartridge.shift_reg;
+                    cartridge.shift_reg = 16;
+                }
+            }
+            map(cartridge);
+        }
+    };
+
+    template<> struct Mapper<2> // UxROM
+    {
+        static void map(Cartridge& cartridge) noexcept
+        {
+            cartridge.map_prg_16k(0, cartridge.bank);
+            cartridge.map_prg_16k(1, cartridge.data.rom16_banks - 1);
+            cartridge.map_chr_8k(0);
+            cartridge.map_nt(cartridge.data.scroll_type);
+        }
+        static void write(Cartridge& cartridge, u16, u8 value) noexcept
+        {
+            cartridge.bank = value & 7;
+            cartridge.map_prg_16k(0, cartridge.bank);
+        }
+    };
+
+    template<> struct Mapper<3> // CNROM
+    {
+        static void map(Cartridge& cartridge) noexcept
+        {
+            cartridge.map_prg_32k(0);
+            cartridge.map_chr_8k(cartridge.bank);
+            cartridge.map_nt(cartridge.data.scroll_type);
+        }
+        static void write(Cartridge& cartridge, u16, u8 value) noexcept
+        {
+            cartridge.bank = value & 3;
+            cartridge.map_chr_8k(cartridge.bank);
+        }
+    };
+
+    template<> struct Mapper<4> // MMC3
+    {
+        static void map(Cartridge& cartridge) noexcept
+        {
+            const auto& regs = cartridge.regs;
+            const unsigned last = 2 * cartridge.data.rom16_banks - 1;
+            const unsigned swap = cartridge.bank & 0x40 ? 2 : 0, invert = cartridge.bank & 0x80 ? 4 : 0;
+
+            cartridge.map_prg_8k(    swap, regs[6] & 0x3F);
+            cartridge.map_prg_8k(1,        regs[7] & 0x3F);
+            cartridge.map_prg_8k(2 - swap, last - 1);
+            cartridge.map_prg_8k(3,        last);
+
+            for (unsigned i = 0; i < 4; ++i) cartridge.map_chr_1k(    invert  + i, (regs[i / 2] & 0xFE) + i % 2);
+            for (unsigned i = 0; i < 4; ++i) cartridge.map_chr_1k((4 ^ invert) + i,  regs[i + 2]);
+            cartridge.map_nt(cartridge.data.scroll_type);
+        }
+        static void write(Cartridge& cartridge, u16 address, u8 value) noexcept
+        {
+            switch (address & 0xE001)
+            {
+                case 0x8000: cartridge.bank = value;                             map(cartridge); break;
+                case 0x8001: cartridge.regs[cartridge.bank & 7] = value;         map(cartridge); break;
+                case 0xA000: cartridge.map_nt(value & 1 ? Cartridge::Data::HORIZ : Cartridge::Data::VERTI); break;
+                case 0xA001:
+                    cartridge.ram_readable =  (value & 0x80);
+                    cartridge.ram_writable =  (value & 0x80) && !(value & 0x40);
+                break;
+                case 0xC000: cartridge.irq_latch   = value;                                              break;
+                case 0xC001: cartridge.irq_counter = 0; cartridge.irq_reload = true;                      break;
+                case 0xE000: cartridge.irq_enabled = false; cartridge.irq_line = false;                   break;
+                case 0xE001: cartridge.irq_enabled = true;                                                break;
+            }
+        }
+        static void a12_rise(Cartridge& cartridge) noexcept
+        {
+            if (!cartridge.irq_counter || cartridge.irq_reload) {cartridge.irq_counter = cartridge.irq_latch; cartridge.irq_reload = false;}
+            else --cartridge.irq_counter;
+            if (!cartridge.irq_counter && cartridge.irq_enabled) cartridge.irq_line = true;
+        }
+    };
+
+    template<> struct Mapper<7> // AxROM
+    {
+        static void map(Cartridge& cartridge) noexcept
+        {
+            cartridge.map_prg_32k(cartridge.bank);
+            cartridge.map_chr_8k(0);
+            cartridge.map_nt(Cartridge::Data::SINGL, cartridge.nt_page);
+        }
+        static void write(Cartridge& cartridge, u16, u8 value) noexcept
+        {
+            cartridge.bank    = value & 7;
+            cartridge.nt_page = value & 16;
+            map(cartridge);
+        }
+    };
+
+    template<unsigned number>
+    void Cartridge::use_mapper() noexcept
+    {
+        mapper_map   = Mapper<number>::map;
+        mapper_write = Mapper<number>::write;
+        if constexpr (number == 4) mapper_a12_rise = Mapper<number>::a12_rise;
+        Mapper<number>::map(*this);
+    }
+}
+
+#endif
@@ -1,30 +1,49 @@
 #include "ppu.h"
 
 #include "cartridge.h"
+#include "compositor.h"
 #include "cpu.h"
+#include "state.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <iterator>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace nes::emulator;
 
-unsigned PPU::rev_bute(unsigned n) noexcept
-{
-    static constexpr unsigned char rev_table[] = {
-      0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0, 0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0,
-      0x08, 0x88, 0x48, 0xC8, 0x28, 0xA8, 0x68, 0xE8, 0x18, 0x98, 0x58, 0xD8, 0x38, 0xB8, 0x78, 0xF8,
-      0x04, 0x84, 0x44, 0xC4, 0x24, 0xA4, 0x64, 0xE4, 0x14, 0x94, 0x54, 0xD4, 0x34, 0xB4, 0x74, 0xF4,
-      0x0C, 0x8C, 0x4C, 0xCC, 0x2C, 0xAC, 0x6C, 0xEC, 0x1C, 0x9C, 0x5C, 0xDC, 0x3C, 0xBC, 0x7C, 0xFC,
-      0x02, 0x82, 0x42, 0xC2, 0x22, 0xA2, 0x62, 0xE2, 0x12, 0x92, 0x52, 0xD2, 0x32, 0xB2, 0x72, 0xF2,
-      0x0A, 0x8A, 0x4A, 0xCA, 0x2A, 0xAA, 0x6A, 0xEA, 0x1A, 0x9A, 0x5A, 0xDA, 0x3A, 0xBA, 0x7A, 0xFA,
-      0x06, 0x86, 0x46, 0xC6, 0x26, 0xA6, 0x66, 0xE6, 0x16, 0x96, 0x56, 0xD6, 0x36, 0xB6, 0x76, 0xF6,
-      0x0E, 0x8E, 0x4E, 0xCE, 0x2E, 0xAE, 0x6E, 0xEE, 0x1E, 0x9E, 0x5E, 0xDE, 0x3E, 0xBE, 0x7E, 0xFE,
-      0x01, 0x81, 0x41, 0xC1, 0x21, 0xA1, 0x61, 0xE1, 0x11, 0x91, 0x51, 0xD1, 0x31, 0xB1, 0x71, 0xF1,
-      0x09, 0x89, 0x49, 0xC9, 0x29, 0xA9, 0x69, 0xE9, 0x19, 0x99, 0x59, 0xD9, 0x39, 0xB9, 0x79, 0xF9,
-      0x05, 0x85, 0x45, 0xC5, 0x25, 0xA5, 0x65, 0xE5, 0x15, 0x95, 0x55, 0xD5, 0x35, 0xB5, 0x75, 0xF5,
-      0x0D, 0x8D, 0x4D, 0xCD, 0x2D, 0xAD, 0x6D, 0xED, 0x1D, 0x9D, 0x5D, 0xDD, 0x3D, 0xBD, 0x7D, 0xFD,
-      0x03, 0x83, 0x43, 0xC3, 0x23, 0xA3, 0x63, 0xE3, 0x13, 0x93, 0x53, 0xD3, 0x33, 0xB3, 0x73, 0xF3,
-      0x0B, 0x8B, 0x4B, 0xCB, 0x2B, 0xAB, 0x6B, 0xEB, 0x1B, 0x9B, 0x5B, 0xDB, 0x3B, 0xBB, 0x7B, 0xFB,
-      0x07, 0x87, 0x47, 0xC7, 0x27, 0xA7, 0x67, 0xE7, 0x17, 0x97, 0x57, 0xD7, 0x37, 0xB7, 0x77, 0xF7,
-      0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF };
-    return rev_table[n];
+namespace
+{
+    // bit n: whether the Y of OAM entry n puts the sprite on the scanline
+    std::uint64_t sprites_in_range(const unsigned char* oam, unsigned scanline, unsigned height) noexcept
+    {
+        std::uint64_t in_range = 0;
+#if defined(__SSE2__)
+        // the Ys of 16 entries packed into one register at a time: scanline - Y < height, without wrapping
+        const __m128i y_bytes = _mm_set1_epi32(0xFF), line = _mm_set1_epi8(static_cast<char>(scanline));
+        const __m128i last = _mm_set1_epi8(static_cast<char>(height - 1));
+        for (unsigned entry = 0; entry < 64; entry += 16)
+        {
+            const auto load = [&](unsigned offset) noexcept
+            {
+                return _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(oam + 4 * entry + offset)), y_bytes);
+            };
+            const __m128i y = _mm_packus_epi16(_mm_packs_epi32(load(0), load(16)), _mm_packs_epi32(load(32), load(48)));
+            const __m128i diff  = _mm_sub_epi8(line, y);
+            const __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(line, y), line);
+            const __m128i near  = _mm_cmpeq_epi8(_mm_min_epu8(diff, last), diff);
+            in_range |= static_cast<std::uint64_t>(_mm_movemask_epi8(_mm_and_si128(above, near))) << entry;
+        }
+#else
+        for (unsigned entry = 0; entry < 64; ++entry)
+            if (scanline - oam[4 * entry] < height) in_range |= std::uint64_t{1} << entry;
+#endif
+        return in_range;
+    }
 }
 
 void PPU::memory_write(u16 address, u8 value) noexcept
@@ -43,50 +62,133 @@ u8 PPU::memory_read(u16 address) const noexcept
         return palette[((address & 0x13) == 0x10 ? address & ~0x10 : address) & 0x1F];
 }
 
+u16 PPU::read_pattern(u16 address, bool flip) const noexcept
+{
+    return flip ? mem_pointers.cartridge->read_pattern<1>(address) : mem_pointers.cartridge->read_pattern<0>(address);
+}
+
 void PPU::set_cpu_nmi(bool nmi) noexcept {mem_pointers.cpu->set_nmi(nmi);}
 
+void PPU::a12(u16 address, long dot) noexcept {mem_pointers.cartridge->a12(address, dot);}
+
+void PPU::set_mem_pointers(const MemPointers& mem_pointers) noexcept
+{
+    this->mem_pointers = mem_pointers;
+    watch_a12 = mem_pointers.cartridge->watches_a12();
+}
+
+void PPU::build_sprite_line() noexcept
+{
+    // the lower sprite slots win, so they are drawn last
+    std::fill(std::begin(sprite_line), std::end(sprite_line), 0);
+    for (int i = 7; i >= 0; --i)
+    {
+        const unsigned flags = (sprite.attr[i] & 0x03) << 2 | (sprite.attr[i] & 0x20 ? SPRITE_LINE_BEHIND : 0) |
+                                                              (!i && s0_curr_scanline ? SPRITE_LINE_ZERO : 0);
+        for (unsigned offset = 0, x = sprite.x[i]; offset < 8 && x < 256; ++offset, ++x)
+            if (const unsigned pat = sprite.pat[i] >> (14 - 2 * offset) & 3)
+                sprite_line[x] = pat | flags;
+    }
+    sprite_line_dirty = false;
+}
+
+void PPU::compose(unsigned to) noexcept
+{
+    if (to <= composed_x) return;
+    if (sprite_line_dirty) build_sprite_line();
+
+    const unsigned bg_start     = !(mask & MASK_MASK_SHOW_BACKGROUND) ? 256 :
+                                  mask & MASK_MASK_SHOW_BACKGROUND_LEFTMOST_8_PIXELS ? 0 : 8;
+    const unsigned sprite_start = !(mask & MASK_MASK_SHOW_SPRITES) ? 256 :
+                                  mask & MASK_MASK_SHOW_SPRITES_LEFTMOST_8_PIXELS ? 0 : 8;
+
+    if (compose_scanline(bg_line, sprite_line, palette, pixel_output + scanline * 256, composed_x, to, bg_start, sprite_start))
+        stat |= MASK_STAT_SPRITE_ZERO_HIT;
+    composed_x = to;
+}
+
 void PPU::render_pixel() noexcept
 {
     const auto x = clks - 1;
-    u16 pal;
 
-    if (!(mask & MASK_MASK_RENDERING_ENABLED)) pal = (~vaddr & 0x3F00) ? 0 : vaddr & 0x1F;
+    if (!(mask & MASK_MASK_RENDERING_ENABLED))
+    {
+        pixel_output[scanline * 256 + x] = memory_read(0x3F00 + ((~vaddr & 0x3F00) ? 0 : vaddr & 0x1F));
+        composed_x = x + 1;
+    }
     else
     {
-        unsigned       spr_pal;
-        bool           spr_behind_bg, spr_is_s0;
+        if (!x) composed_x = 0;
+        bg_line[x] = (at_shift >> (14 - 2 * xfine) & 3) << 2 | (bg_shift >> (30 - 2 * xfine) & 3);
+        if (x == 255) compose(256);
+    }
+}
+
+template<Accuracy accuracy>
+bool PPU::render_tile() noexcept
+{
+    // a whole tile of a visible scanline at once: dots 8k+1 .. 8k+8, before the last tile that
+    // also does the vertical scroll; only taken when no CPU access can land in the middle of it
+    if (scanline >= 240 || (clks & 7) != 1 || clks > 241 || write_addr_delay ||
+                                                      !(mask & MASK_MASK_RENDERING_ENABLED))
+        return false;
+
+    if (accuracy == Accuracy::exact && open_bus_decay_timer)
+    {
+        if (open_bus_decay_timer <= 8) {open_bus_decay_timer = 0; open_bus_data = 0;}
+        else                            open_bus_decay_timer -= 8;
+    }
 
-        const unsigned spr_pat = sprite_pixel(spr_pal, spr_behind_bg, spr_is_s0);
-        unsigned        bg_pat;
+    // the attribute bits shifted in during the tile all come from the latch
+    const u32 at_bits = (at_shift & 0xFFFF) << 16 | at_latch * 0x5555;
+    const unsigned x = clks - 1;
+    if (!x) composed_x = 0;
 
-        if (!(mask & MASK_MASK_SHOW_BACKGROUND) || (!(mask & MASK_MASK_SHOW_BACKGROUND_LEFTMOST_8_PIXELS) && x < 8))
-            bg_pat = 0;
-        else {
-            bg_pat = ((bg_shift_hi >> (15 - xfine) & 1) << 1) |
-                      (bg_shift_lo >> (15 - xfine) & 1);
-            if (spr_pat && bg_pat && spr_is_s0 && x != 255) stat |= MASK_STAT_SPRITE_ZERO_HIT;
-        }
-        if (spr_pat && !(spr_behind_bg && bg_pat)) pal = 0x10 + (spr_pal << 2) + spr_pat;
-        else {
-            if (!bg_pat) pal = 0;
-            else
-            {
-                const unsigned attr = ((at_shift_hi >> (7 - xfine) & 1) << 1) |
-                                       (at_shift_lo >> (7 - xfine) & 1);
-                pal = (attr << 2) | bg_pat;
-            }
-        }
+    for (unsigned i = 0; i < 8; ++i, ++clks)
+    {
+        if (sprite_overflow) {sprite_overflow = false; stat |= MASK_STAT_SPRITE_OVERFLOW;}
+        const unsigned shift = 30 - 2 * (xfine + i);
+        bg_line[x + i] = (at_bits >> shift & 3) << 2 | (bg_shift >> shift & 3);
+        sprite_operations<accuracy>();
     }
-    pixel_output[scanline * 256 + x] = memory_read(0x3F00 + pal);
+
+    // the fetches of background_misc() for the eight dots
+    nt    = memory_read(open_bus_addr);
+    open_bus_addr = addr_at();
+    at    = memory_read(open_bus_addr); if (vaddr & 64) at >>= 4;
+                                        if (vaddr &  2) at >>= 2;
+    open_bus_addr = addr_bg();
+    notify_a12(open_bus_addr, -4);
+    bg_lo = read_pattern(open_bus_addr, false);
+    open_bus_addr += 8;
+    notify_a12(open_bus_addr, -2);
+    bg_hi = read_pattern(open_bus_addr, false); h_scroll();
+
+    bg_shift <<= 16; at_shift = at_shift << 16 | at_latch * 0x5555;
+
+    open_bus_addr = addr_nt(); reload_shift_regs();
+    return true;
 }
 
+template<Accuracy accuracy>
 void PPU::sprite_operations() noexcept
 {
     if (scanline < 240)
     {
+        // the fast evaluation is done at once, right before the sprites are loaded
+        if (accuracy == Accuracy::fast && clks < 256) return;
         switch (clks)
         {
-            case 256: scan_oam_addr = 0; sprite_loading(); break;
+            case 256:
+                if constexpr (accuracy == Accuracy::fast) sprite_line_evaluation();
+                else if (evaluation_pending)
+                {
+                    sprite_evaluation(evaluation_from, 256); evaluation_pending = false;
+                    // raised on the dot after
+                    if (sprite_overflow) {sprite_overflow = false; stat |= MASK_STAT_SPRITE_OVERFLOW;}
+                }
+                scan_oam_addr = 0; sprite_loading();
+            break;
             case 340:                                      break;
             case   0:
                 scan_oam_addr = oam_addr_overflow = scan_oam_addr_overflow = sprite_overflow_detection = 0;
@@ -94,55 +196,97 @@ void PPU::sprite_operations() noexcept
             break;
             default:
                      if (clks <  64) scan_oam[clks / 2] = 255;
-                else if (clks < 256)  sprite_evaluation();
-                else if (clks < 320) {sprite_loading(); s0_curr_scanline = s0_next_scanline; oam_addr = 0;}
+                else if (clks < 256) {if (!evaluation_pending) {evaluation_pending = true; evaluation_from = clks;}}
+                else if (clks < 320) {sprite_loading(); s0_curr_scanline = s0_next_scanline; oam_addr = 0;
+                                      sprite_line_dirty = true;}
             break;
         }
     }
 }
 
-void PPU::sprite_evaluation() noexcept
+// the dots [from, to) of the evaluation, as the ticks would have done them
+void PPU::sprite_evaluation(unsigned from, unsigned to) noexcept
+{
+    const std::uint64_t in_range = from == 64 && to == 256 && !oam_addr && !scan_oam_addr && !oam_copy &&
+                                   !oam_addr_overflow && !scan_oam_addr_overflow && !sprite_overflow_detection
+                                 ? sprites_in_range(oam, scanline, ctrl & CTRL_MASK_SPRITE_SIZE ? 16 : 8) : ~0ull;
+    if (const unsigned found = std::bitset<64>(in_range).count(); found < 8)
+    {
+        // From entry 0 with fewer than 8 sprites on the line: each of them is copied in 4 dot pairs, every
+        // other entry takes 1 pair and leaves its Y in the next free slot. After the last entry oam_addr
+        // wraps, and the pairs left only move it on by 4 and reload oam_tmp from that slot
+        s0_next_scanline = in_range & 1;
+        unsigned slot = 0;
+        for (unsigned entry = 0; entry < 64; ++entry)
+            if (in_range >> entry & 1) {std::copy_n(oam + 4 * entry, 4, scan_oam + slot); slot += 4;}
+        if (!(in_range >> 63)) scan_oam[slot] = oam[252];
+
+        scan_oam_addr     = slot;
+        oam_addr          = 4 * (32 - 3 * found);
+        oam_addr_overflow = true;
+        oam_tmp           = scan_oam[slot];
+        return;
+    }
+
+    for (unsigned dot = from; dot < to; ++dot)
+    {
+        if (sprite_overflow) {sprite_overflow = false; stat |= MASK_STAT_SPRITE_OVERFLOW;}
+        if (dot & 1) sprite_evaluation_step(dot == 65);
+        else         oam_tmp = oam[oam_addr];
+    }
+}
+
+// the odd dot of a pair, after the even one has read oam_tmp
+void PPU::sprite_evaluation_step(bool first) noexcept
 {
-    switch (clks & 1)
+    const bool in_range = (scanline - oam_tmp < (ctrl & CTRL_MASK_SPRITE_SIZE ? 16 : 8));
+    if (first) s0_next_scanline = in_range;
+    if (!scan_oam_addr_overflow && !oam_addr_overflow)
+        scan_oam[scan_oam_addr] = oam_tmp;
+    else
+        oam_tmp = scan_oam[scan_oam_addr];
+    if (oam_copy > 0)
+    {
+        --oam_copy;
+        if (!(++     oam_addr &= 0xFF)) {     oam_addr_overflow = true;                             oam_copy = 0;}
+        if (!(++scan_oam_addr &= 0x1F)) {scan_oam_addr_overflow = sprite_overflow_detection = true; oam_copy = 0;}
+    }
+    else if (in_range && !scan_oam_addr_overflow && !oam_addr_overflow)
+    {
+        oam_copy = 3;
+        if (!(++     oam_addr &= 0xFF)) {     oam_addr_overflow = true;                             oam_copy = 0;}
+        if (!(++scan_oam_addr &= 0x1F)) {scan_oam_addr_overflow = sprite_overflow_detection = true; oam_copy = 0;}
+    }
+    else if (sprite_overflow_detection)
     {
-        case 0: oam_tmp = oam[oam_addr]; break;
-        case 1:
+        if (in_range && !oam_addr_overflow) {sprite_overflow = true; sprite_overflow_detection = false;}
+        else
         {
-            const bool in_range = (scanline - oam_tmp < (ctrl & CTRL_MASK_SPRITE_SIZE ? 16 : 8));
-            if (clks == 65) s0_next_scanline = in_range;
-            if (!scan_oam_addr_overflow && !oam_addr_overflow)
-                scan_oam[scan_oam_addr] = oam_tmp;
-            else 
-                oam_tmp = scan_oam[scan_oam_addr];
-            if (oam_copy > 0)
-            {
-                --oam_copy;
-                if (!(++     oam_addr &= 0xFF)) {     oam_addr_overflow = true;                             oam_copy = 0;}
-                if (!(++scan_oam_addr &= 0x1F)) {scan_oam_addr_overflow = sprite_overflow_detection = true; oam_copy = 0;}
-            }
-            else if (in_range && !scan_oam_addr_overflow && !oam_addr_overflow)
-            {
-                oam_copy = 3;
-                if (!(++     oam_addr &= 0xFF)) {     oam_addr_overflow = true;                             oam_copy = 0;}
-                if (!(++scan_oam_addr &= 0x1F)) {scan_oam_addr_overflow = sprite_overflow_detection = true; oam_copy = 0;}
-            }
-            else if (sprite_overflow_detection)
-            {
-                if (in_range && !oam_addr_overflow) {sprite_overflow = true; sprite_overflow_detection = false;}
-                else 
-                {
-                    const u16 temp = ((oam_addr + 4) & ~3) | ((oam_addr + 1) & 3); oam_addr = temp & 255;
-                    if (temp & 256) oam_addr_overflow = true;
-                }
-            }
-            else
-            {
-                const u16 temp = oam_addr + 4; oam_addr          = temp & 0xFC;
-                if       (temp & 256)          oam_addr_overflow = true;
-            }
-        break;
+            const u16 temp = ((oam_addr + 4) & ~3) | ((oam_addr + 1) & 3); oam_addr = temp & 255;
+            if (temp & 256) oam_addr_overflow = true;
         }
     }
+    else
+    {
+        const u16 temp = oam_addr + 4; oam_addr          = temp & 0xFC;
+        if       (temp & 256)          oam_addr_overflow = true;
+    }
+}
+
+void PPU::sprite_line_evaluation() noexcept
+{
+    // from OAM entry 0, the first 8 sprites in range; a 9th sets the overflow flag
+    const unsigned height = ctrl & CTRL_MASK_SPRITE_SIZE ? 16 : 8;
+    std::fill(std::begin(scan_oam), std::end(scan_oam), 255);
+    unsigned found = 0;
+    for (unsigned entry = 0; entry < 256; entry += 4)
+    {
+        if (scanline - oam[entry] >= height) continue;
+        if (found == 32) {stat |= MASK_STAT_SPRITE_OVERFLOW; break;}
+        std::copy_n(oam + entry, 4, scan_oam + found);
+        found += 4;
+    }
+    s0_next_scanline = scanline - oam[0] < height;
 }
 
 void PPU::sprite_loading() noexcept
@@ -168,7 +312,7 @@ void PPU::background_misc() noexcept
         case 340:                                                                   break;
         case   0: open_bus_addr = addr_nt();                                        break;
         case 254: shift_shifters(); open_bus_addr += 8;                 v_scroll(); break;
-        case 255: shift_shifters(); bg_hi = memory_read(open_bus_addr);             break;
+        case 255: shift_shifters(); notify_a12(open_bus_addr); bg_hi = read_pattern(open_bus_addr, false); break;
         case 256: shift_shifters(); reload_shift_regs();                h_update(); break;
         case 320: open_bus_addr = addr_nt();                                        break;
         case 338: open_bus_addr = addr_nt();                                        break;
@@ -188,17 +332,18 @@ void PPU::background_misc() noexcept
                     case 1: nt    = memory_read(open_bus_addr);                           break;
                     case 3: at    = memory_read(open_bus_addr); if (vaddr & 64) at >>= 4;
                                                                 if (vaddr &  2) at >>= 2; break;
-                    case 5: bg_lo = memory_read(open_bus_addr);                           break;
-                    case 7: bg_hi = memory_read(open_bus_addr); h_scroll();               break;
+                    case 5: notify_a12(open_bus_addr); bg_lo = read_pattern(open_bus_addr, false);             break;
+                    case 7: notify_a12(open_bus_addr); bg_hi = read_pattern(open_bus_addr, false); h_scroll(); break;
                 }
             }
         break;
     }
 }
 
-void PPU::tick() noexcept
+template<Accuracy accuracy>
+inline void PPU::tick() noexcept
 {
-    if (open_bus_decay_timer && !--open_bus_decay_timer) open_bus_data = 0;
+    if (accuracy == Accuracy::exact && open_bus_decay_timer && !--open_bus_decay_timer) open_bus_data = 0;
     if (sprite_overflow) {sprite_overflow = false; stat |= MASK_STAT_SPRITE_OVERFLOW;}
     if (scanline < 240 && clks >= 1 && clks <= 256) render_pixel();
     switch (scanline)
@@ -214,14 +359,138 @@ void PPU::tick() noexcept
     }
     if (mask & MASK_MASK_RENDERING_ENABLED)
     {
-        sprite_operations();
+        sprite_operations<accuracy>();
         background_misc();
     }
-    if (write_addr_delay && !--write_addr_delay) vaddr = tmp_vaddr;
+    if (write_addr_delay && !--write_addr_delay) {vaddr = tmp_vaddr; notify_a12(vaddr);}
     if (++clks > 340)
     {
-        if (++scanline == 262) {scanline = 0; odd_frame_post = !odd_frame_post;}
+        if (++scanline == 262) {scanline = 0; odd_frame_post = !odd_frame_post; frame_start += 262 * 341;}
         clks -= 341;
     }
 }
 
+
+template<Accuracy accuracy>
+long PPU::skip_idle(long ticks) noexcept
+{
+    // nothing but the dot counter and the open bus decay changes from the post-render scanline
+    // up to the pre-render one, except the vblank edge itself at 241:0
+    if (write_addr_delay || sprite_overflow) return 0;
+    long end;
+         if (scanline == 240)                         end = 241 * 341;
+    else if (scanline == 241 && clks == 0)            return 0;
+    else if (scanline >= 241 && scanline < 261)       end = 261 * 341;
+    else                                              return 0;
+
+    const long position = scanline * 341 + clks, count = end - position < ticks ? end - position : ticks;
+    if (accuracy == Accuracy::exact && open_bus_decay_timer)
+    {
+        if (static_cast<long>(open_bus_decay_timer) <= count) {open_bus_decay_timer = 0; open_bus_data = 0;}
+        else                                open_bus_decay_timer -= count;
+    }
+    scanline = (position + count) / 341;
+    clks     = (position + count) % 341;
+    return count;
+}
+
+void PPU::run(long ticks) noexcept
+{
+    if (accuracy == Accuracy::exact) run_ticks<Accuracy::exact>(ticks);
+    else                             run_ticks<Accuracy::fast >(ticks);
+}
+
+template<Accuracy accuracy>
+void PPU::run_ticks(long ticks) noexcept
+{
+    while (ticks > 0)
+    {
+        if (const long skipped = skip_idle<accuracy>(ticks)) ticks -= skipped;
+        else if (ticks >= 8 && render_tile<accuracy>())    ticks -= 8;
+        else {tick<accuracy>(); --ticks;}
+    }
+    if (evaluation_pending) {sprite_evaluation(evaluation_from, clks); evaluation_pending = false;}
+    // the pixels so far have to be final before the CPU gets to see the sprite 0 hit flag or change
+    // anything they depend on
+    if (scanline < 240 && clks > 1) compose(clks < 257 ? clks - 1 : 256);
+}
+
+long PPU::ticks_to_nmi() const noexcept
+{
+    if (!(ctrl & CTRL_MASK_GENERATE_NMI)) return never;
+    constexpr long frame = 262 * 341, vblank = 241 * 341;
+    const long distance = (vblank - static_cast<long>(scanline * 341 + clks) + frame) % frame;
+    // one dot less in case the odd frame skips the last dot of the pre-render scanline
+    return distance ? distance - 1 : 0;
+}
+
+long PPU::ticks_to_status_change() const noexcept
+{
+    // the vblank edge at 241:0, the flags cleared from 261:0 and the scanlines that can show sprite 0
+    constexpr long frame = 262 * 341;
+    const long position = scanline * 341 + clks;
+    const auto distance = [position](long to) noexcept {return (to - position + frame) % frame;};
+
+    long ticks = std::min(distance(241 * 341), distance(261 * 341));
+    if ((mask & MASK_MASK_RENDERING_ENABLED) && !(stat & MASK_STAT_SPRITE_ZERO_HIT) && oam[0] < 239)
+    {
+        const long first = (oam[0] + 1) * 341;
+        if (position >= first && position < first + 16 * 341) return 0;
+        ticks = std::min(ticks, distance(first));
+    }
+    // one dot less in case the odd frame skips the last dot of the pre-render scanline
+    return ticks ? ticks - 1 : 0;
+}
+
+long PPU::ticks_to_a12_rises(unsigned rises) const noexcept
+{
+    // only the fetches of the pre-render and the visible scanlines move A12 on their own, the counted
+    // rises are at least a12_filter dots apart, but one such gap can straddle the idle scanlines
+    if (!rises || !(mask & MASK_MASK_RENDERING_ENABLED)) return never;
+    constexpr long frame = 262 * 341, idle_start = 240 * 341, idle_end = 261 * 341, idle = idle_end - idle_start;
+
+    long dots = (rises - 1) * Cartridge::a12_filter, position = scanline * 341 + clks, ticks = 0, frames = 1;
+    if (position >= idle_start && position < idle_end) {ticks = idle_end - position; position = idle_end;}
+
+    for (long run = position >= idle_end ? frame - position + idle_start : idle_start - position; dots > run;
+                                                                                  run = frame - idle, ++frames)
+    {
+        ticks += run + idle;
+        dots  -= run + Cartridge::a12_filter;
+    }
+    // one dot less for every odd frame that may skip one
+    ticks += dots > 0 ? dots : 0;
+    return ticks > frames ? ticks - frames : 0;
+}
+
+template<class Stream>
+void PPU::state(Stream& stream) noexcept
+{
+    stream.u8(ctrl); stream.u8(mask); stream.u8(stat); stream.u8(data_buff); stream.u8(open_bus_data);
+    stream.bytes(ram, sizeof ram); stream.bytes(palette, sizeof palette);
+    stream.bytes(oam, sizeof oam); stream.bytes(scan_oam, sizeof scan_oam); stream.u8(oam_tmp);
+
+    stream.u8(sprite.id); stream.u8(sprite.y);
+    stream.bytes(sprite.x, sizeof sprite.x); stream.bytes(sprite.attr, sizeof sprite.attr);
+    for (auto& pat : sprite.pat) stream.u16(pat);
+    stream.flag(sprite.in_range);
+
+    stream.u8(xfine); stream.u8(nt); stream.u8(at); stream.u8(at_latch);
+    stream.u8(oam_addr); stream.u8(scan_oam_addr); stream.u8(oam_copy);
+    stream.u16(bg_lo); stream.u16(bg_hi); stream.u16(at_shift); stream.u16(open_bus_addr); stream.u32(bg_shift);
+    stream.u16(clks); stream.u16(scanline); stream.u16(vaddr); stream.u16(tmp_vaddr); stream.u16(open_bus_decay_timer);
+    stream.u8(write_addr_delay);
+
+    stream.flag(write_toggle); stream.flag(odd_frame_post);
+    stream.flag(oam_addr_overflow); stream.flag(scan_oam_addr_overflow);
+    stream.flag(sprite_overflow_detection); stream.flag(sprite_overflow);
+    stream.flag(s0_next_scanline); stream.flag(s0_curr_scanline);
+    stream.u64(frame_start);
+
+    // the pixels of the current line before composed_x are final, the ones after it not rendered yet
+    stream.u16(composed_x);
+    if constexpr (Stream::loading) sprite_line_dirty = true;
+}
+
+template void PPU::state(StateWriter&) noexcept;
+template void PPU::state(StateReader&) noexcept;
@@ -1,6 +1,7 @@
 #ifndef PPU_H
 #define PPU_H
 
+#include "accuracy.h"
 #include "int_alias.h"
 
 namespace nes::emulator
@@ -18,7 +19,6 @@ namespace nes::emulator
         };
 
     private:
-        static unsigned rev_bute(unsigned byte) noexcept;
         enum CtrlMasks : u8 {
             CTRL_MASK_BASE_NAMETABLE_ADDRESS            = 0b00000011, // 0 - $2000; 1 - $2400; 2 - $2800; 3 - $2C00
             CTRL_MASK_VRAM_ADDRESS_INCREMENT            = 0b00000100, // 0 - 1; 1 - 32
@@ -54,16 +54,26 @@ namespace nes::emulator
 
         struct
         {
-            unsigned char id, y, x[8], attr[8], pat_l[8], pat_h[8];
+            unsigned char id, y, x[8], attr[8];
+            u16 pat[8];
             bool in_range;
         } sprite;
 
         unsigned char *pixel_output = nullptr;
 
-        u8 xfine, nt, at, bg_lo, bg_hi, at_latch_hi, at_latch_lo;
+        // the visible scanline is composed in runs: the background pixels (attribute << 2 | pattern) are
+        // collected as they are rendered and merged with the sprite line whenever the CPU could observe
+        // the result, or the line ends; the sprite line is rebuilt once after the sprites are reloaded
+        unsigned char bg_line[256], sprite_line[256];
+        unsigned composed_x = 0;
+        bool sprite_line_dirty = true;
+
+        u8 xfine, nt, at, at_latch;
         u8 oam_addr = 0, scan_oam_addr, oam_copy;
 
-        u16 bg_shift_lo, bg_shift_hi, at_shift_lo, at_shift_hi, open_bus_addr;
+        // background pattern rows and shift registers hold 2 bits per pixel, leftmost pixel in the top bits
+        u16 bg_lo, bg_hi, at_shift, open_bus_addr;
+        u32 bg_shift;
         u16 clks = 0, scanline = 261, vaddr = 0, tmp_vaddr, open_bus_decay_timer = 0;
 
         u8 write_addr_delay = 0;
@@ -72,27 +82,39 @@ namespace nes::emulator
         bool oam_addr_overflow, scan_oam_addr_overflow, sprite_overflow_detection, sprite_overflow = false;
         bool s0_next_scanline, s0_curr_scanline;
 
+        // the dot at the start of the current frame, for the timing of the A12 rises the mapper may count
+        long frame_start = 0;
+        bool watch_a12 = false;
+
+        // the sprite evaluation (dots 64 to 255) cannot be observed before the run ends, so its dots are
+        // done in one go at dot 256 or at the end of the run, from evaluation_from on
+        unsigned evaluation_from = 0;
+        bool     evaluation_pending = false;
+
+        Accuracy accuracy = Accuracy::exact;
+
         MemPointers mem_pointers;
 
         void memory_write(u16 address, u8 value) noexcept;
         u8 memory_read(u16 address) const noexcept;
+        u16 read_pattern(u16 address, bool flip) const noexcept;
 
         void set_cpu_nmi(bool nmi) noexcept;
 
+        long dot_time() const noexcept {return frame_start + scanline * 341 + clks;}
+        void a12(u16 address, long dot) noexcept;
+        void notify_a12(u16 address, long offset = 0) noexcept {if (watch_a12) a12(address, dot_time() + offset);}
+
         void reload_shift_regs() noexcept
         {
-            bg_shift_lo &= 0xFF00; bg_shift_lo |= bg_lo;
-            bg_shift_hi &= 0xFF00; bg_shift_hi |= bg_hi;
-            at_latch_lo = at      & 1;
-            at_latch_hi = at >> 1 & 1;
+            bg_shift &= 0xFFFF0000; bg_shift |= bg_lo | bg_hi << 1;
+            at_latch  = at & 3;
         }
 
         void shift_shifters() noexcept
         {
-            bg_shift_lo <<= 1;
-            bg_shift_hi <<= 1;
-            at_shift_lo = (at_shift_lo << 1) | at_latch_lo;
-            at_shift_hi = (at_shift_hi << 1) | at_latch_hi;
+            bg_shift <<= 2;
+            at_shift = (at_shift << 2) | at_latch;
         }
 
         void v_scroll() noexcept
@@ -192,6 +214,7 @@ namespace nes::emulator
 
         void open_bus_write_data() noexcept
         {
+            notify_a12(vaddr);
             memory_write(vaddr, open_bus_data);
             access_data_increment();
         }
@@ -209,6 +232,7 @@ namespace nes::emulator
 
         void open_bus_read_data() noexcept
         {
+            notify_a12(vaddr);
             u8 temp = memory_read(vaddr);
             if (vaddr < 0x3F00) {temp = data_buff; data_buff = memory_read(vaddr); open_bus_refresh<255>(temp); }
             else                {temp = data_buff            = memory_read(vaddr); open_bus_refresh< 63>(temp); }
@@ -227,15 +251,11 @@ namespace nes::emulator
         template<bool high>
         void fetch_sprite_pattern(int spr_index) noexcept
         {
-            unsigned char* pat;
-            if constexpr (high) pat = sprite.pat_h + spr_index;
-            else                pat = sprite.pat_l + spr_index;
-            if (!sprite.in_range) *pat = 0;
-            else
-            {
-                *pat = memory_read(open_bus_addr);
-                if (sprite.attr[spr_index] & 0x40) *pat = rev_bute(*pat);
-            }
+            u16& pat = sprite.pat[spr_index];
+            notify_a12(open_bus_addr);
+            const u16 row = sprite.in_range ? read_pattern(open_bus_addr, sprite.attr[spr_index] & 0x40) : 0;
+            if constexpr (high) pat = (pat & 0x5555) | row << 1;
+            else                pat =                  row;
         }
 
         template<bool high>
@@ -257,38 +277,27 @@ namespace nes::emulator
             }
         }
 
-        unsigned sprite_pixel(unsigned &spr_pal, bool &spr_behind_bg, bool &spr_is_s0) noexcept
-        {
-            const unsigned x = clks - 1;
-            if (!(mask & MASK_MASK_SHOW_SPRITES) || (!(mask & MASK_MASK_SHOW_SPRITES_LEFTMOST_8_PIXELS) && x < 8))
-                return   0;
-            for (int i = 0; i < 8; ++i)
-            {
-                const unsigned offset = x - sprite.x[i];
-                if (offset >= 8) continue;
-
-                const unsigned pat_res = ((sprite.pat_h[i] >> (7 - offset) & 1) << 1) |
-                                          (sprite.pat_l[i] >> (7 - offset) & 1);
-                if (pat_res)
-                {
-                    spr_pal       = sprite.attr[i] & 0x03;
-                    spr_behind_bg = sprite.attr[i] & 0x20;
-                    spr_is_s0     =            !i && s0_curr_scanline;
-                    return pat_res;
-                }
-            }
-            return 0;
-        }
+        void build_sprite_line() noexcept;
+        void compose(unsigned to) noexcept;
 
-        void sprite_operations() noexcept;
-        void sprite_evaluation() noexcept;
+        template<Accuracy accuracy> void sprite_operations() noexcept;
+        void sprite_evaluation(unsigned from, unsigned to) noexcept;
+        void sprite_evaluation_step(bool first) noexcept;
+        void sprite_line_evaluation() noexcept;
         void sprite_loading() noexcept;
 
         void background_misc() noexcept;
 
         void render_pixel() noexcept;
+        template<Accuracy accuracy> bool render_tile() noexcept;
+
+        template<Accuracy accuracy> void tick() noexcept;
+        template<Accuracy accuracy> long skip_idle(long ticks) noexcept;
+        template<Accuracy accuracy> void run_ticks(long ticks) noexcept;
 
     public:
+        static constexpr long never = -1;
+
         template<unsigned reg>
         void reg_write(u8 value) noexcept
         {
@@ -312,10 +321,22 @@ namespace nes::emulator
             return open_bus_data;
         }
 
-        void set_mem_pointers(const MemPointers& mem_pointers) noexcept {this->mem_pointers = mem_pointers;}
+        void set_mem_pointers(const MemPointers& mem_pointers) noexcept;
         void set_pixel_output(unsigned char* pixel_output) noexcept {this->pixel_output = pixel_output;}
         bool odd_frame() noexcept {return odd_frame_post;}
-        void tick() noexcept;
+        // takes effect from the next run(); best changed between frames
+        void set_accuracy(Accuracy accuracy) noexcept {this->accuracy = accuracy;}
+
+        void run(long ticks) noexcept;
+
+        // the number of ticks that can be run without the NMI line being raised by the vblank edge
+        long ticks_to_nmi() const noexcept;
+        // a lower bound of the ticks that can be run without the vblank or the sprite 0 hit flag changing
+        long ticks_to_status_change() const noexcept;
+        // a lower bound of the ticks the pattern fetches take to make `rises` A12 rises the mapper counts
+        long ticks_to_a12_rises(unsigned rises) const noexcept;
+
+        template<class Stream> void state(Stream& stream) noexcept;
     };
 }
 
@@ -0,0 +1,602 @@
+#include "recompiler.h"
+
+#include "cpu.h"
+#include "apu.h"
+#include "cartridge.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define NES_RECOMPILER 1
+#endif
+
+using namespace nes::emulator;
+
+#ifdef NES_RECOMPILER
+
+static_assert(offsetof(Recompiler::Registers, A)    ==  0 && offsetof(Recompiler::Registers, X)  == 1 &&
+              offsetof(Recompiler::Registers, Y)    ==  2 && offsetof(Recompiler::Registers, P)  == 3 &&
+              offsetof(Recompiler::Registers, S)    ==  4 && offsetof(Recompiler::Registers, PC) == 6 &&
+              offsetof(Recompiler::Registers, time) ==  8 && offsetof(Recompiler::Registers, ram) == 16,
+              "the translated code addresses the registers at these offsets");
+
+namespace
+{
+    enum Field : unsigned char {A = 0, X = 1, Y = 2, P = 3, S = 4};
+
+    // the x86-64 registers the translated code uses: rdi holds the Registers, rsi the internal RAM,
+    // eax, ecx (the RAM index) and edx are scratch
+    enum Reg : unsigned char {EAX = 0, ECX = 1, EDX = 2};
+    enum Alu : unsigned char {ADD = 0x01, OR = 0x09, AND = 0x21, SUB = 0x29, XOR = 0x31, CMP = 0x39, MOV = 0x89};
+    enum AluImm : unsigned char {ADD_I = 0, OR_I = 1, AND_I = 4, SUB_I = 5, XOR_I = 6, CMP_I = 7};
+    enum Cond : unsigned char {CC_B = 2, CC_AE = 3, CC_Z = 4, CC_NZ = 5};
+
+    class Assembler final
+    {
+        unsigned char* out;
+
+        void d32(std::uint32_t value) noexcept {std::memcpy(out, &value, 4); out += 4;}
+        void d16(std::uint16_t value) noexcept {std::memcpy(out, &value, 2); out += 2;}
+
+    public:
+        explicit Assembler(unsigned char* out) noexcept : out{out} {}
+
+        unsigned char* position() const noexcept {return out;}
+        void byte(unsigned value) noexcept {*out++ = value;}
+
+        // movzx dst, byte [rdi + field] / mov byte [rdi + field], src
+        void load (Reg dst, Field field) noexcept {byte(0x0F); byte(0xB6); byte(0x47 | dst << 3); byte(field);}
+        void store(Field field, Reg src) noexcept {byte(0x88); byte(0x47 | src << 3); byte(field);}
+
+        // movzx dst, byte [rsi + rcx] / mov byte [rsi + rcx], src
+        void load_ram (Reg dst) noexcept {byte(0x0F); byte(0xB6); byte(0x04 | dst << 3); byte(0x0E);}
+        void store_ram(Reg src) noexcept {byte(0x88); byte(0x04 | src << 3); byte(0x0E);}
+
+        void mov(Reg dst, std::uint32_t value) noexcept {byte(0xB8 | dst); d32(value);}
+        void alu(Alu op, Reg dst, Reg src) noexcept {byte(op); byte(0xC0 | src << 3 | dst);}
+        void alu(AluImm op, Reg dst, std::uint32_t value) noexcept {byte(0x81); byte(0xC0 | op << 3 | dst); d32(value);}
+        void shl(Reg dst, unsigned count) noexcept {byte(0xC1); byte(0xE0 | dst); byte(count);}
+        void shr(Reg dst, unsigned count) noexcept {byte(0xC1); byte(0xE8 | dst); byte(count);}
+        void zero_extend(Reg dst) noexcept {byte(0x0F); byte(0xB6); byte(0xC0 | dst << 3 | dst);} // movzx dst, dst8
+        void test(Reg a, Reg b) noexcept {byte(0x85); byte(0xC0 | b << 3 | a);}
+        void set(Cond cond, Reg dst) noexcept {byte(0x0F); byte(0x90 | cond); byte(0xC0 | dst);}
+
+        // and/or byte [rdi + field], value / or byte [rdi + field], src / add, sub byte [rdi + field], 1
+        void and_field(Field field, unsigned value) noexcept {byte(0x80); byte(0x67); byte(field); byte(value);}
+        void or_field (Field field, unsigned value) noexcept {byte(0x80); byte(0x4F); byte(field); byte(value);}
+        void or_field (Field field, Reg src) noexcept {byte(0x08); byte(0x47 | src << 3); byte(field);}
+        void inc_field(Field field) noexcept {byte(0x80); byte(0x47); byte(field); byte(1);}
+        void dec_field(Field field) noexcept {byte(0x80); byte(0x6F); byte(field); byte(1);}
+
+        void test_p(unsigned mask) noexcept {load(EAX, P); byte(0xA8); byte(mask);}
+        unsigned char* jump(Cond cond) noexcept {byte(0x70 | cond); byte(0); return out;}
+        void land(unsigned char* jump) noexcept {jump[-1] = out - jump;}
+
+        void push_rcx() noexcept {byte(0x51);}
+        void pop_rcx () noexcept {byte(0x59);}
+
+        void prologue() noexcept {byte(0x48); byte(0x8B); byte(0x77); byte(16);}   // mov rsi, [rdi + 16]
+        void set_pc(std::uint16_t pc) noexcept {byte(0x66); byte(0xC7); byte(0x47); byte(6); d16(pc);}
+        void set_pc_ax() noexcept {byte(0x66); byte(0x89); byte(0x47); byte(6);}
+        void add_time(std::uint32_t cycles) noexcept {byte(0x48); byte(0x81); byte(0x47); byte(8); d32(cycles);}
+        void add_time(Reg cycles) noexcept {byte(0x48); byte(0x01); byte(0x47 | cycles << 3); byte(8);}
+        void ret() noexcept {byte(0xC3);}
+    };
+
+    enum Operation : unsigned char {
+        NONE,
+        LDA, LDX, LDY, STA, STX, STY, ADC, SBC, AND_, ORA, EOR, CMP_, CPX, CPY, BIT,
+        INC, DEC, ASL, LSR, ROL, ROR,
+        INX, INY, DEX, DEY, TAX, TAY, TXA, TYA, TSX, TXS,
+        CLC, SEC, CLV, CLD, SED, SEI, NOP, PHA, PHP, PLA,
+        JSR, RTS, JMP, BRANCH
+    };
+    enum Mode : unsigned char {IMP, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IZX, IZY, REL};
+
+    struct Opcode
+    {
+        Operation operation = NONE;
+        Mode      mode      = IMP;
+        unsigned  cycles    = 0;
+        bool      page_cycle = false; // one more when indexing crosses a page
+    };
+
+    // the opcodes that can be translated, with the cycles the interpreter takes for them
+    constexpr auto opcodes = []
+    {
+        struct {Opcode table[256];} o{};
+        const auto set = [&o](unsigned code, Operation operation, Mode mode, unsigned cycles, bool page_cycle = false)
+        {
+            o.table[code] = {operation, mode, cycles, page_cycle};
+        };
+        const auto loads = [&set](Operation operation, unsigned imm, unsigned zp, unsigned zpx, unsigned abs, Mode indexed = ZPX)
+        {
+            if (imm) set(imm, operation, IMM, 2);
+            set(zp, operation, ZP, 3);
+            if (zpx) set(zpx, operation, indexed, 4);
+            set(abs, operation, ABS, 4);
+        };
+        loads(LDA, 0xA9, 0xA5, 0xB5, 0xAD); loads(LDX, 0xA2, 0xA6, 0xB6, 0xAE, ZPY); loads(LDY, 0xA0, 0xA4, 0xB4, 0xAC);
+        loads(STA, 0,    0x85, 0x95, 0x8D); loads(STX, 0,    0x86, 0x96, 0x8E, ZPY); loads(STY, 0,    0x84, 0x94, 0x8C);
+        loads(ADC, 0x69, 0x65, 0x75, 0x6D); loads(SBC, 0xE9, 0xE5, 0xF5, 0xED); set(0xEB, SBC, IMM, 2);
+        loads(AND_, 0x29, 0x25, 0x35, 0x2D); loads(ORA, 0x09, 0x05, 0x15, 0x0D); loads(EOR, 0x49, 0x45, 0x55, 0x4D);
+        loads(CMP_, 0xC9, 0xC5, 0xD5, 0xCD); loads(CPX, 0xE0, 0xE4, 0, 0xEC); loads(CPY, 0xC0, 0xC4, 0, 0xCC);
+        loads(BIT, 0, 0x24, 0, 0x2C);
+
+        const auto indexed = [&set](Operation operation, unsigned base)
+        {
+            set(base + 0x01, operation, IZX, 6); set(base + 0x11, operation, IZY, 5, true);
+            set(base + 0x19, operation, ABY, 4, true); set(base + 0x1D, operation, ABX, 4, true);
+        };
+        indexed(ORA, 0x00); indexed(AND_, 0x20); indexed(EOR, 0x40); indexed(ADC, 0x60);
+        indexed(LDA, 0xA0); indexed(CMP_, 0xC0); indexed(SBC, 0xE0);
+        set(0xBC, LDY, ABX, 4, true); set(0xBE, LDX, ABY, 4, true);
+        set(0x81, STA, IZX, 6); set(0x91, STA, IZY, 6); set(0x99, STA, ABY, 5); set(0x9D, STA, ABX, 5);
+
+        const auto rmw = [&set](Operation operation, unsigned zp, unsigned zpx, unsigned abs, unsigned acc)
+        {
+            set(zp, operation, ZP, 5); set(zpx, operation, ZPX, 6); set(abs, operation, ABS, 6);
+            set(abs + 0x10, operation, ABX, 7);
+            if (acc) set(acc, operation, IMP, 2);
+        };
+        rmw(INC, 0xE6, 0xF6, 0xEE, 0); rmw(DEC, 0xC6, 0xD6, 0xCE, 0);
+        rmw(ASL, 0x06, 0x16, 0x0E, 0x0A); rmw(LSR, 0x46, 0x56, 0x4E, 0x4A);
+        rmw(ROL, 0x26, 0x36, 0x2E, 0x2A); rmw(ROR, 0x66, 0x76, 0x6E, 0x6A);
+
+        set(0xE8, INX, IMP, 2); set(0xC8, INY, IMP, 2); set(0xCA, DEX, IMP, 2); set(0x88, DEY, IMP, 2);
+        set(0xAA, TAX, IMP, 2); set(0xA8, TAY, IMP, 2); set(0x8A, TXA, IMP, 2); set(0x98, TYA, IMP, 2);
+        set(0xBA, TSX, IMP, 2); set(0x9A, TXS, IMP, 2);
+        set(0x18, CLC, IMP, 2); set(0x38, SEC, IMP, 2); set(0xB8, CLV, IMP, 2); set(0xD8, CLD, IMP, 2);
+        set(0xF8, SED, IMP, 2); set(0x78, SEI, IMP, 2); set(0xEA, NOP, IMP, 2);
+        set(0x48, PHA, IMP, 3); set(0x08, PHP, IMP, 3); set(0x68, PLA, IMP, 4);
+        set(0x20, JSR, ABS, 6); set(0x60, RTS, IMP, 6); set(0x4C, JMP, ABS, 3);
+        for (unsigned code : {0x10, 0x30, 0x50, 0x70, 0x90, 0xB0, 0xD0, 0xF0}) set(code, BRANCH, REL, 2);
+        return o;
+    }();
+
+    constexpr unsigned size(Mode mode) noexcept {return mode == IMP ? 1 : mode == ABS || mode == ABX || mode == ABY ? 3 : 2;}
+
+    // the bytes one instruction can take at most, the epilogues included
+    constexpr std::size_t max_instruction_bytes = 128;
+    constexpr unsigned    max_block_instructions = 32;
+
+    // P's N and Z from the result in eax; clobbers ecx and edx
+    void set_nz(Assembler& a) noexcept
+    {
+        a.load(EDX, P);
+        a.alu(AND_I, EDX, 0x7D);
+        a.alu(MOV, ECX, EAX);
+        a.alu(AND_I, ECX, 0x80);
+        a.alu(OR, EDX, ECX);
+        a.test(EAX, EAX);
+        unsigned char* nonzero = a.jump(CC_NZ);
+        a.alu(OR_I, EDX, 0x02);
+        a.land(nonzero);
+        a.store(P, EDX);
+    }
+
+    // where the block returns to the interpreter from, before an instruction it cannot run
+    struct Exit
+    {
+        u16      pc;
+        unsigned cycles;
+    };
+
+    void leave(Assembler& a, const Exit& exit) noexcept {a.set_pc(exit.pc); a.add_time(exit.cycles); a.ret();}
+
+    // ecx: the internal RAM index of a memory operand. The indirect ones leave the block when the
+    // address is not internal RAM
+    void address(Assembler& a, const Opcode& opcode, unsigned operand, const Exit& exit) noexcept
+    {
+        switch (opcode.mode)
+        {
+            case ZPX:
+            case ZPY:
+                a.load(ECX, opcode.mode == ZPX ? X : Y);
+                a.alu(ADD_I, ECX, operand);
+                a.zero_extend(ECX);
+                break;
+            case ABX:
+            case ABY:
+                a.load(ECX, opcode.mode == ABX ? X : Y);
+                a.alu(ADD_I, ECX, operand & 0xFF);
+                if (opcode.page_cycle) {a.alu(MOV, EDX, ECX); a.shr(EDX, 8); a.add_time(EDX);}
+                a.alu(ADD_I, ECX, operand & 0xFF00);
+                a.alu(AND_I, ECX, 0x7FF);
+                break;
+            case IZX:
+            case IZY:
+            {
+                if (opcode.mode == IZX) {a.load(ECX, X); a.alu(ADD_I, ECX, operand); a.zero_extend(ECX);}
+                else                      a.mov(ECX, operand);
+                a.load_ram(EAX);
+                a.alu(ADD_I, ECX, 1);
+                a.zero_extend(ECX);
+                a.load_ram(EDX);
+                a.shl(EDX, 8);
+                a.alu(OR, EAX, EDX);
+                if (opcode.mode == IZY)
+                {
+                    a.load(ECX, Y);
+                    a.alu(MOV, EDX, EAX);
+                    a.alu(ADD, EDX, ECX);
+                    a.alu(AND_I, EDX, 0xFFFF);
+                }
+                else a.alu(MOV, EDX, EAX);
+                a.alu(CMP_I, EDX, 0x2000);
+                unsigned char* ram = a.jump(CC_B);
+                leave(a, exit);
+                a.land(ram);
+                if (opcode.page_cycle) {a.alu(AND_I, EAX, 0xFF); a.alu(ADD, EAX, ECX); a.shr(EAX, 8); a.add_time(EAX);}
+                a.alu(MOV, ECX, EDX);
+                a.alu(AND_I, ECX, 0x7FF);
+                break;
+            }
+            default: a.mov(ECX, operand & 0x7FF); break;
+        }
+    }
+
+    // edx: the operand value
+    void operand(Assembler& a, const Opcode& opcode, unsigned value, const Exit& exit) noexcept
+    {
+        if (opcode.mode == IMM) {a.mov(EDX, value); return;}
+        address(a, opcode, value, exit);
+        a.load_ram(EDX);
+    }
+
+    void push(Assembler& a, Reg value) noexcept
+    {
+        a.load(ECX, S);
+        a.alu(ADD_I, ECX, 0x100);
+        a.store_ram(value);
+        a.dec_field(S);
+    }
+    void pop(Assembler& a, Reg value) noexcept
+    {
+        a.inc_field(S);
+        a.load(ECX, S);
+        a.alu(ADD_I, ECX, 0x100);
+        a.load_ram(value);
+    }
+
+    // eax: the value shifted or rotated, C from ecx
+    void shift(Assembler& a, Operation operation) noexcept
+    {
+        if (operation == ROL || operation == ROR) {a.load(EDX, P); a.alu(AND_I, EDX, 1);}
+        a.alu(MOV, ECX, EAX);
+        if (operation == ASL || operation == ROL) {a.shr(ECX, 7); a.shl(EAX, 1); if (operation == ROL) a.alu(OR, EAX, EDX); a.zero_extend(EAX);}
+        else                                      {a.alu(AND_I, ECX, 1); a.shr(EAX, 1); if (operation == ROR) {a.shl(EDX, 7); a.alu(OR, EAX, EDX);}}
+        a.and_field(P, 0xFE);
+        a.or_field(P, ECX);
+    }
+
+    // A += edx + C, with C and V, as CPU::adc()
+    void add(Assembler& a) noexcept
+    {
+        a.load(EAX, A);
+        a.load(ECX, P);
+        a.alu(AND_I, ECX, 1);
+        a.alu(ADD, ECX, EAX);
+        a.alu(ADD, ECX, EDX);   // ecx = A + d + C
+        a.alu(XOR, EAX, ECX);
+        a.alu(XOR, EDX, ECX);
+        a.alu(AND, EAX, EDX);
+        a.shr(EAX, 1);
+        a.alu(AND_I, EAX, 0x40); // V
+        a.and_field(P, 0xBE);
+        a.or_field(P, EAX);
+        a.alu(MOV, EAX, ECX);
+        a.shr(EAX, 8);           // C
+        a.or_field(P, EAX);
+        a.alu(MOV, EAX, ECX);
+        a.zero_extend(EAX);
+        a.store(A, EAX);
+        set_nz(a);
+    }
+
+    void compare(Assembler& a, Field reg) noexcept
+    {
+        a.load(EAX, reg);
+        a.alu(XOR, ECX, ECX);
+        a.alu(CMP, EAX, EDX);
+        a.set(CC_AE, ECX);
+        a.and_field(P, 0xFE);
+        a.or_field(P, ECX);
+        a.alu(SUB, EAX, EDX);
+        a.zero_extend(EAX);
+        set_nz(a);
+    }
+
+    void transfer(Assembler& a, Field from, Field to, bool flags = true) noexcept
+    {
+        a.load(EAX, from);
+        a.store(to, EAX);
+        if (flags) set_nz(a);
+    }
+
+    void step(Assembler& a, Field reg, bool increment) noexcept
+    {
+        a.load(EAX, reg);
+        a.alu(increment ? ADD_I : SUB_I, EAX, 1);
+        a.zero_extend(EAX);
+        a.store(reg, EAX);
+        set_nz(a);
+    }
+
+    // emits one instruction; false if it ends the block
+    bool emit(Assembler& a, const Opcode& opcode, unsigned value, u16 pc, unsigned& cycles) noexcept
+    {
+        const Mode mode = opcode.mode;
+        const Exit exit{pc, cycles};
+        cycles += opcode.cycles;
+        switch (opcode.operation)
+        {
+            case LDA:  operand(a, opcode, value, exit); a.alu(MOV, EAX, EDX); a.store(A, EAX); set_nz(a); break;
+            case LDX:  operand(a, opcode, value, exit); a.alu(MOV, EAX, EDX); a.store(X, EAX); set_nz(a); break;
+            case LDY:  operand(a, opcode, value, exit); a.alu(MOV, EAX, EDX); a.store(Y, EAX); set_nz(a); break;
+            case STA:  address(a, opcode, value, exit); a.load(EAX, A); a.store_ram(EAX); break;
+            case STX:  address(a, opcode, value, exit); a.load(EAX, X); a.store_ram(EAX); break;
+            case STY:  address(a, opcode, value, exit); a.load(EAX, Y); a.store_ram(EAX); break;
+            case ADC:  operand(a, opcode, value, exit); add(a); break;
+            case SBC:  operand(a, opcode, value, exit); a.alu(XOR_I, EDX, 0xFF); add(a); break;
+            case AND_: operand(a, opcode, value, exit); a.load(EAX, A); a.alu(AND, EAX, EDX); a.store(A, EAX); set_nz(a); break;
+            case ORA:  operand(a, opcode, value, exit); a.load(EAX, A); a.alu(OR,  EAX, EDX); a.store(A, EAX); set_nz(a); break;
+            case EOR:  operand(a, opcode, value, exit); a.load(EAX, A); a.alu(XOR, EAX, EDX); a.store(A, EAX); set_nz(a); break;
+            case CMP_: operand(a, opcode, value, exit); compare(a, A); break;
+            case CPX:  operand(a, opcode, value, exit); compare(a, X); break;
+            case CPY:  operand(a, opcode, value, exit); compare(a, Y); break;
+            case BIT:
+            {
+                operand(a, opcode, value, exit);
+                a.and_field(P, 0x3D);
+                a.alu(MOV, ECX, EDX);
+                a.alu(AND_I, ECX, 0xC0);
+                a.or_field(P, ECX);
+                a.load(EAX, A);
+                a.test(EAX, EDX);
+                unsigned char* nonzero = a.jump(CC_NZ);
+                a.or_field(P, 0x02);
+                a.land(nonzero);
+                break;
+            }
+            case INC:
+            case DEC:
+                address(a, opcode, value, exit);
+                a.load_ram(EAX);
+                a.alu(opcode.operation == INC ? ADD_I : SUB_I, EAX, 1);
+                a.zero_extend(EAX);
+                a.store_ram(EAX);
+                set_nz(a);
+                break;
+            case ASL:
+            case LSR:
+            case ROL:
+            case ROR:
+                if (mode == IMP) {a.load(EAX, A); shift(a, opcode.operation); a.store(A, EAX); set_nz(a); break;}
+                address(a, opcode, value, exit);
+                a.load_ram(EAX);
+                a.push_rcx();
+                shift(a, opcode.operation);
+                a.pop_rcx();
+                a.store_ram(EAX);
+                set_nz(a);
+                break;
+
+            case INX: step(a, X, true ); break;
+            case INY: step(a, Y, true ); break;
+            case DEX: step(a, X, false); break;
+            case DEY: step(a, Y, false); break;
+            case TAX: transfer(a, A, X); break;
+            case TAY: transfer(a, A, Y); break;
+            case TXA: transfer(a, X, A); break;
+            case TYA: transfer(a, Y, A); break;
+            case TSX: transfer(a, S, X); break;
+            case TXS: transfer(a, X, S, false); break;
+
+            case CLC: a.and_field(P, 0xFE); break;
+            case SEC: a.or_field (P, 0x01); break;
+            case CLV: a.and_field(P, 0xBF); break;
+            case CLD: a.and_field(P, 0xF7); break;
+            case SED: a.or_field (P, 0x08); break;
+            case SEI: a.or_field (P, 0x04); break;
+            case NOP: break;
+
+            case PHA: a.load(EAX, A); push(a, EAX); break;
+            case PHP: a.load(EAX, P); a.alu(OR_I, EAX, 0x30); push(a, EAX); break;
+            case PLA: pop(a, EAX); a.store(A, EAX); set_nz(a); break;
+
+            case JSR:
+                a.mov(EAX, (pc + 2) >> 8 & 0xFF); push(a, EAX);
+                a.mov(EAX, (pc + 2)      & 0xFF); push(a, EAX);
+                a.set_pc(value); a.add_time(cycles); a.ret();
+                return false;
+            case RTS:
+                pop(a, EAX);
+                pop(a, EDX);
+                a.shl(EDX, 8);
+                a.alu(OR, EAX, EDX);
+                a.alu(ADD_I, EAX, 1);
+                a.set_pc_ax(); a.add_time(cycles); a.ret();
+                return false;
+            case JMP:
+                a.set_pc(value); a.add_time(cycles); a.ret();
+                return false;
+            case BRANCH:
+            {
+                // bit 7-6 of the opcode: the flag (N, V, C, Z); bit 5: the value that takes the branch
+                static constexpr unsigned flags[]{0x80, 0x40, 0x01, 0x02};
+                const u16 next = (pc + 2) & 0xFFFF, target = (next + (((value & 0xFF) ^ 128) - 128)) & 0xFFFF;
+                a.test_p(flags[value >> 14 & 3]);
+                unsigned char* taken = a.jump(value >> 13 & 1 ? CC_NZ : CC_Z);
+                a.set_pc(next);   a.add_time(cycles);                                     a.ret();
+                a.land(taken);
+                a.set_pc(target); a.add_time(cycles + 1 + (((target ^ next) & 0xFF00) != 0)); a.ret();
+                return false;
+            }
+            case NONE: break;
+        }
+        return true;
+    }
+}
+
+Recompiler::Recompiler(bool compare) : blocks(4096), compare{compare}
+{
+    void* memory = ::mmap(nullptr, code_bytes, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::runtime_error{"recompiler initialization error"};
+    code = static_cast<unsigned char*>(memory);
+}
+
+Recompiler::~Recompiler() {::munmap(code, code_bytes);}
+
+void Recompiler::translate(Block& block, const unsigned char* page, unsigned offset, u16 pc) noexcept
+{
+    if (code_bytes - code_used < max_block_instructions * max_instruction_bytes)
+    {
+        // full: start over, but for the block being filled
+        for (auto& cached : blocks) if (&cached != &block) cached = {};
+        code_used = 0;
+    }
+
+    Assembler a{code + code_used};
+    a.prologue();
+    unsigned cycles = 0, page_cycles = 0, instructions = 0;
+    bool open = true;
+    while (open && instructions < max_block_instructions)
+    {
+        const Opcode& opcode = opcodes.table[page[offset]];
+        const unsigned bytes = size(opcode.mode);
+        if (opcode.operation == NONE || offset + bytes > 0x800) break;
+
+        unsigned value = bytes > 1 ? page[offset + 1] : 0;
+        if (bytes > 2) value |= page[offset + 2] << 8;
+        // absolute operands only when they are internal RAM
+        if (opcode.mode == ABS && opcode.operation != JSR && opcode.operation != JMP && value >= 0x2000) break;
+        // JMP * is left to the interpreter, which skips it to the next event
+        if (opcode.operation == JMP && value == pc) break;
+        if ((opcode.mode == ABX || opcode.mode == ABY) && value + 0xFF >= 0x2000) break;
+        if (opcode.mode == REL) value |= page[offset] << 8; // the branch opcode tells the condition
+
+        open = emit(a, opcode, value, pc, cycles);
+        page_cycles += opcode.page_cycle;
+        ++instructions;
+        offset += bytes;
+        pc = (pc + bytes) & 0xFFFF;
+    }
+    if (!instructions) {block.untranslatable = true; return;}
+    if (open) {a.set_pc(pc); a.add_time(cycles); a.ret();}
+
+    block.code         = reinterpret_cast<Code>(code + code_used);
+    block.instructions = instructions;
+    block.cycles       = cycles + page_cycles + 2; // and a taken branch to another page
+    code_used = a.position() - code;
+    ++stats.translated;
+}
+
+bool Recompiler::matches_interpreter(CPU& cpu, const Block& block) noexcept
+{
+    const auto save = [&cpu](Registers& registers, unsigned char* ram)
+    {
+        registers = {static_cast<std::uint8_t>(cpu.A), static_cast<std::uint8_t>(cpu.X), static_cast<std::uint8_t>(cpu.Y),
+                     static_cast<std::uint8_t>(cpu.P), static_cast<std::uint8_t>(cpu.S), static_cast<std::uint16_t>(cpu.PC),
+                     cpu.cpu_time, cpu.internal_ram};
+        std::memcpy(ram, cpu.internal_ram, sizeof cpu.internal_ram);
+    };
+    const auto restore = [&cpu](const Registers& registers, const unsigned char* ram)
+    {
+        cpu.A = registers.A; cpu.X = registers.X; cpu.Y = registers.Y; cpu.P = registers.P; cpu.S = registers.S;
+        cpu.PC = registers.PC; cpu.cpu_time = registers.time;
+        std::memcpy(cpu.internal_ram, ram, sizeof cpu.internal_ram);
+    };
+
+    Registers before, translated, interpreted;
+    unsigned char ram_before[sizeof cpu.internal_ram], ram_translated[sizeof cpu.internal_ram], ram_interpreted[sizeof cpu.internal_ram];
+    save(before, ram_before);
+
+    // the translated block first: it may leave early, and the interpreter then runs as far
+    save(translated, ram_translated);
+    block.code(&translated);
+    std::memcpy(ram_translated, cpu.internal_ram, sizeof ram_translated);
+    restore(before, ram_before);
+
+    cpu.recompiler = nullptr;
+    for (unsigned i = 0; i < block.instructions && cpu.cpu_time < translated.time; ++i) cpu.instruction();
+    cpu.recompiler = this;
+    save(interpreted, ram_interpreted);
+
+    const bool same = translated.A == interpreted.A && translated.X == interpreted.X && translated.Y == interpreted.Y &&
+                      translated.P == interpreted.P && translated.S == interpreted.S && translated.PC == interpreted.PC &&
+                      translated.time == interpreted.time && !std::memcmp(ram_translated, ram_interpreted, sizeof ram_interpreted);
+    if (!same)
+        std::clog << std::hex << "recompiler mismatch in the block at $" << before.PC << ": translated PC $" << translated.PC <<
+                     " A " << +translated.A << " X " << +translated.X << " Y " << +translated.Y << " P " << +translated.P <<
+                     " S " << +translated.S << ", interpreted PC $" << interpreted.PC << " A " << +interpreted.A << " X " <<
+                     +interpreted.X << " Y " << +interpreted.Y << " P " << +interpreted.P << " S " << +interpreted.S <<
+                     std::dec << ", cycles " << translated.time - before.time << " / " << interpreted.time - before.time << std::endl;
+    // the interpreter's result stays either way
+    return same;
+}
+
+void Recompiler::run(CPU& cpu, cpu_time_t end_time) noexcept
+{
+    while (cpu.cpu_time < end_time && cpu.pending_interrupt == CPU::NuLL && !cpu.nmi)
+    {
+        // PRG ROM only
+        const unsigned page = cpu.PC >> 11;
+        if (page < 16 || cpu.write_pages[page] || !cpu.read_pages[page]) return;
+        const unsigned char* key = cpu.read_pages[page] + (cpu.PC & 0x7FF);
+
+        Block& block = blocks[(reinterpret_cast<std::uintptr_t>(key) ^ reinterpret_cast<std::uintptr_t>(key) >> 12 ^ cpu.PC >> 11)
+                              % blocks.size()];
+        if (block.key != key || block.pc != cpu.PC) block = {key, static_cast<u16>(cpu.PC)};
+        if (!block.code)
+        {
+            if (block.untranslatable || ++block.hits < hot_hits) return;
+            translate(block, cpu.read_pages[page], cpu.PC & 0x7FF, cpu.PC);
+            if (!block.code) return;
+        }
+
+        // every interrupt poll inside the block must find nothing to do, as the interpreter would
+        const cpu_time_t end = cpu.cpu_time + block.cycles;
+        if (end > end_time || end > cpu.ppu_deadline) return;
+        if (!(cpu.P & CPU::MI) && (end >= cpu.mem_pointers.apu->earliest_irq() - 1 || cpu.mem_pointers.cartridge->irq())) return;
+
+        ++stats.executed;
+        stats.instructions += block.instructions;
+        const cpu_time_t start = cpu.cpu_time;
+        if (compare)
+        {
+            if (!matches_interpreter(cpu, block)) {++stats.mismatches; block.code = nullptr; block.untranslatable = true;}
+        }
+        else
+        {
+            Registers registers{static_cast<std::uint8_t>(cpu.A), static_cast<std::uint8_t>(cpu.X), static_cast<std::uint8_t>(cpu.Y),
+                                static_cast<std::uint8_t>(cpu.P), static_cast<std::uint8_t>(cpu.S), static_cast<std::uint16_t>(cpu.PC),
+                                cpu.cpu_time, cpu.internal_ram};
+            block.code(&registers);
+            cpu.A = registers.A; cpu.X = registers.X; cpu.Y = registers.Y; cpu.P = registers.P; cpu.S = registers.S;
+            cpu.PC = registers.PC; cpu.cpu_time = registers.time;
+        }
+        // left at its first instruction: an indirect access outside internal RAM
+        if (cpu.cpu_time == start) return;
+    }
+}
+
+#else
+
+Recompiler::Recompiler(bool compare) : compare{compare}
+{
+    throw std::runtime_error{"the recompiler needs x86-64 Linux"};
+}
+
+Recompiler::~Recompiler() = default;
+
+void Recompiler::translate(Block&, const unsigned char*, unsigned, u16) noexcept {}
+bool Recompiler::matches_interpreter(CPU&, const Block&) noexcept {return true;}
+void Recompiler::run(CPU&, cpu_time_t) noexcept {}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include "int_alias.h"
+
+#include "third_party/Nes_Snd_Emu-0.1.7/nes_apu/Nes_Apu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nes::emulator
+{
+    class CPU;
+
+    // Translates hot straight-line PRG ROM code into x86-64 (on x86-64 Linux only). A block is keyed by
+    // the ROM byte of its first opcode and by its PC, which the translated code has built in (the same
+    // bytes can be mirrored or mapped at another address), so bank switches need no invalidation and
+    // RAM code, which can change, is never translated. A block covers the opcodes
+    // that only touch internal RAM and registers, up to a jump, a branch or the first other opcode (an
+    // indirect access leaves it when the address is not internal RAM); it runs only when it cannot end
+    // past the frame, the PPU deadline or an interrupt, so the interpreter keeps every I/O access and
+    // interrupt boundary
+    class Recompiler final
+    {
+    public:
+        struct Stats
+        {
+            unsigned long long translated = 0, executed = 0, instructions = 0, mismatches = 0;
+        };
+
+        // the 6502 state the translated code works on, in a fixed layout
+        struct Registers
+        {
+            std::uint8_t   A, X, Y, P, S;
+            std::uint16_t  PC;
+            cpu_time_t     time;
+            unsigned char* ram;
+        };
+
+    private:
+        using Code = void (*)(Registers*);
+
+        struct Block
+        {
+            const unsigned char* key = nullptr;
+            u16      pc = 0;
+            Code     code = nullptr;
+            unsigned hits = 0, instructions = 0, cycles = 0; // cycles: at most
+            bool     untranslatable = false;
+        };
+
+        static constexpr unsigned    hot_hits   = 8;
+        static constexpr std::size_t code_bytes = 1 << 20;
+
+        std::vector<Block> blocks; // direct-mapped
+        unsigned char* code = nullptr;
+        std::size_t    code_used = 0;
+        bool           compare;
+        Stats          stats;
+
+        void translate(Block& block, const unsigned char* page, unsigned offset, u16 pc) noexcept;
+        bool matches_interpreter(CPU& cpu, const Block& block) noexcept;
+
+    public:
+        // compare: run every block through the interpreter as well and keep its result on a mismatch
+        // (reported on std::clog, the block is not run translated again). Throws std::runtime_error
+        // where there is no backend
+        explicit Recompiler(bool compare = false);
+        ~Recompiler();
+
+        Recompiler(const Recompiler&) = delete;
+        Recompiler& operator=(const Recompiler&) = delete;
+
+        // runs the translated blocks starting at the CPU's PC while it can, from CPU::run_cpu_until()
+        void run(CPU& cpu, cpu_time_t end_time) noexcept;
+
+        const Stats& get_stats() const noexcept {return stats;}
+    };
+}
+
+#endif
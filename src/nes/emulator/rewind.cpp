@@ -0,0 +1,161 @@
+#include "rewind.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+using namespace nes::emulator;
+
+namespace
+{
+    unsigned char* put_count(unsigned char* out, std::size_t count) noexcept
+    {
+        for (; count >= 0x80; count >>= 7) *out++ = (count & 0x7F) | 0x80;
+        *out++ = count;
+        return out;
+    }
+
+    const unsigned char* get_count(const unsigned char* in, std::size_t& count) noexcept
+    {
+        count = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            const unsigned byte = *in++;
+            count |= std::size_t{byte & 0x7Fu} << shift;
+            if (!(byte & 0x80)) return in;
+        }
+    }
+
+    std::size_t equal_run(const unsigned char* a, const unsigned char* b, std::size_t size) noexcept
+    {
+        std::size_t run = 0;
+        for (std::uint64_t x, y; run + 8 <= size; run += 8)
+        {
+            std::memcpy(&x, a + run, 8); std::memcpy(&y, b + run, 8);
+            if (x != y) break;
+        }
+        while (run < size && a[run] == b[run]) ++run;
+        return run;
+    }
+}
+
+// a delta is a sequence of (unchanged bytes, changed bytes, their XOR) runs; an unchanged
+// run shorter than 4 bytes costs more as a token than as part of the XOR
+std::size_t Rewind::pack(const unsigned char* from, const unsigned char* to, std::size_t size, unsigned char* out) noexcept
+{
+    unsigned char* const start = out;
+    for (std::size_t i = 0; i < size;)
+    {
+        const std::size_t unchanged = equal_run(from + i, to + i, size - i);
+        i += unchanged;
+
+        std::size_t changed = 0;
+        while (i + changed < size)
+        {
+            const std::size_t rest = size - i - changed;
+            const std::size_t same = equal_run(from + i + changed, to + i + changed, rest < 4 ? rest : 4);
+            if (same == 4 || same == rest) break;
+            changed += same + 1;
+        }
+
+        out = put_count(out, unchanged);
+        out = put_count(out, changed);
+        for (std::size_t j = 0; j < changed; ++j) *out++ = from[i + j] ^ to[i + j];
+        i += changed;
+    }
+    return out - start;
+}
+
+void Rewind::unpack(const unsigned char* in, unsigned char* state, std::size_t size) noexcept
+{
+    for (std::size_t i = 0, unchanged, changed; i < size;)
+    {
+        in = get_count(in, unchanged); i += unchanged;
+        in = get_count(in, changed);
+        for (std::size_t j = 0; j < changed; ++j) state[i + j] ^= *in++;
+        i += changed;
+    }
+}
+
+Rewind::Rewind(const Machine& machine, std::size_t capacity, unsigned interval) :
+    machine{machine}, interval{interval ? interval : 1}, ring(capacity), entries(capacity / 64 + 1)
+{
+    const std::size_t size = state_size(machine);
+    latest.resize(size);
+    current.resize(size);
+    // a token never takes more than the bytes it covers but for the counts of the first one
+    packed.resize(size + 2 * 10);
+}
+
+void Rewind::push(std::size_t size) noexcept
+{
+    const auto drop_oldest = [this]() noexcept
+    {
+        ring_bytes -= entries[first].size;
+        first = (first + 1) % entries.size(); --count;
+    };
+
+    if (size > ring.size())
+    {
+        // the older deltas cannot be reached without this one
+        while (count) drop_oldest();
+        return;
+    }
+    if (count == entries.size()) drop_oldest();
+
+    const std::size_t end = count ? entries[(first + count - 1) % entries.size()].offset +
+                                    entries[(first + count - 1) % entries.size()].size : 0;
+    std::size_t offset = end;
+    const bool wrapped = offset + size > ring.size();
+    if (wrapped) offset = 0;
+
+    // the entries run circularly from the oldest one up to end, so the oldest ones are in the way
+    while (count)
+    {
+        const Entry& oldest = entries[first];
+        if (!(wrapped && oldest.offset >= end) && (oldest.offset >= offset + size || offset >= oldest.offset + oldest.size))
+            break;
+        drop_oldest();
+    }
+
+    std::memcpy(ring.data() + offset, packed.data(), size);
+    entries[(first + count) % entries.size()] = {offset, size};
+    ++count; ring_bytes += size;
+}
+
+void Rewind::capture() noexcept
+{
+    if (!save_state(machine, current.data(), current.size())) return;
+    ++captured;
+    if (has_latest)
+    {
+        const std::size_t size = pack(current.data(), latest.data(), current.size(), packed.data());
+        push(size);
+        ++packed_deltas; packed_bytes += size;
+    }
+    std::swap(latest, current);
+    has_latest = true;
+}
+
+void Rewind::frame() noexcept
+{
+    if (++frames < interval) return;
+    frames = 0;
+    capture();
+}
+
+bool Rewind::step() noexcept
+{
+    if (!has_latest) return false;
+    load_state(machine, latest.data(), latest.size());
+    frames = 0;
+
+    if (count)
+    {
+        const Entry& newest = entries[(first + count - 1) % entries.size()];
+        unpack(ring.data() + newest.offset, latest.data(), latest.size());
+        --count; ring_bytes -= newest.size;
+    }
+    else has_latest = false;
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "state.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace nes::emulator
+{
+    // A history of save states in a fixed amount of memory. Only the newest capture is kept whole;
+    // every older one is the XOR with its successor, its zero runs compressed, in a ring that drops
+    // the oldest deltas when full
+    class Rewind final
+    {
+        struct Entry
+        {
+            std::size_t offset, size;
+        };
+
+        Machine machine;
+        unsigned interval, frames = 0;
+
+        std::vector<unsigned char> latest, current, packed, ring;
+        bool has_latest = false;
+
+        std::vector<Entry> entries; // circular, oldest at first
+        std::size_t first = 0, count = 0, ring_bytes = 0;
+        std::size_t captured = 0, packed_deltas = 0, packed_bytes = 0; // ever, dropped ones included
+
+        static std::size_t pack(const unsigned char* from, const unsigned char* to, std::size_t size, unsigned char* out) noexcept;
+        static void unpack(const unsigned char* in, unsigned char* state, std::size_t size) noexcept;
+
+        void push(std::size_t size) noexcept;
+        void capture() noexcept;
+
+    public:
+        // capacity: the bytes of the delta ring; interval: the frames between two captures
+        Rewind(const Machine& machine, std::size_t capacity, unsigned interval);
+
+        // after every frame, between frames
+        void frame() noexcept;
+
+        // Loads the newest capture and forgets it, so every step goes further back.
+        // Returns false when the history is empty
+        bool step() noexcept;
+
+        std::size_t history_bytes() const noexcept {return ring_bytes;}
+        std::size_t history_captures() const noexcept {return count + has_latest;}
+        std::size_t state_bytes() const noexcept {return latest.size();}
+        std::size_t captures() const noexcept {return captured;}
+        std::size_t deltas() const noexcept {return packed_deltas;}
+        std::size_t delta_bytes() const noexcept {return packed_bytes;}
+    };
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "scaler.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCALER_X86
+#include <immintrin.h>
+#endif
+
+using namespace nes::emulator;
+
+namespace
+{
+    using Kernel = void (*)(const unsigned char*, unsigned, const std::uint32_t*, unsigned, unsigned char*, long) noexcept;
+
+    void scale_scalar(const unsigned char* in, unsigned rows, const std::uint32_t* colors, unsigned scale,
+                      unsigned char* out, long pitch) noexcept
+    {
+        for (unsigned row = 0; row < rows; ++row, in += 256, out += scale * pitch)
+        {
+            auto* line = reinterpret_cast<std::uint32_t*>(out);
+            for (unsigned x = 0; x < 256; ++x)
+                for (unsigned i = 0; i < scale; ++i) *line++ = colors[in[x] & 63];
+            for (unsigned copy = 1; copy < scale; ++copy) std::memcpy(out + copy * pitch, out, 256 * scale * sizeof (std::uint32_t));
+        }
+    }
+
+#ifdef SCALER_X86
+    // 4 pixels at a time, looked up one by one and spread with dword shuffles
+    __attribute__((target("sse2")))
+    void scale_sse2(const unsigned char* in, unsigned rows, const std::uint32_t* colors, unsigned scale,
+                    unsigned char* out, long pitch) noexcept
+    {
+        for (unsigned row = 0; row < rows; ++row, in += 256, out += scale * pitch)
+            for (unsigned x = 0; x < 256; x += 4)
+            {
+                const __m128i c = _mm_setr_epi32(colors[in[x] & 63], colors[in[x + 1] & 63], colors[in[x + 2] & 63], colors[in[x + 3] & 63]);
+                __m128i spread[4]{c, c, c, c};
+                switch (scale)
+                {
+                    case 1: spread[0] = c; break;
+                    case 2: spread[0] = _mm_unpacklo_epi32(c, c); spread[1] = _mm_unpackhi_epi32(c, c); break;
+                    case 3: spread[0] = _mm_shuffle_epi32(c, _MM_SHUFFLE(1, 0, 0, 0));
+                            spread[1] = _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 2, 1, 1));
+                            spread[2] = _mm_shuffle_epi32(c, _MM_SHUFFLE(3, 3, 3, 2)); break;
+                    default: spread[0] = _mm_shuffle_epi32(c, 0x00); spread[1] = _mm_shuffle_epi32(c, 0x55);
+                             spread[2] = _mm_shuffle_epi32(c, 0xAA); spread[3] = _mm_shuffle_epi32(c, 0xFF); break;
+                }
+                for (unsigned copy = 0; copy < scale; ++copy)
+                    for (unsigned i = 0; i < scale; ++i)
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + copy * pitch + (x * scale + 4 * i) * 4), spread[i]);
+            }
+    }
+
+    // 8 pixels at a time with one gather, spread with cross-lane dword permutes
+    __attribute__((target("avx2")))
+    void scale_avx2(const unsigned char* in, unsigned rows, const std::uint32_t* colors, unsigned scale,
+                    unsigned char* out, long pitch) noexcept
+    {
+        // output pixel j of a group of 8 * scale comes from input pixel j / scale
+        __m256i pattern[4];
+        for (unsigned i = 0; i < scale; ++i)
+            pattern[i] = _mm256_setr_epi32((8 * i + 0) / scale, (8 * i + 1) / scale, (8 * i + 2) / scale, (8 * i + 3) / scale,
+                                           (8 * i + 4) / scale, (8 * i + 5) / scale, (8 * i + 6) / scale, (8 * i + 7) / scale);
+        const __m256i index_mask = _mm256_set1_epi32(63);
+
+        for (unsigned row = 0; row < rows; ++row, in += 256, out += scale * pitch)
+            for (unsigned x = 0; x < 256; x += 8)
+            {
+                const __m256i index = _mm256_and_si256(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + x))), index_mask);
+                const __m256i c = _mm256_i32gather_epi32(reinterpret_cast<const int*>(colors), index, 4);
+                for (unsigned i = 0; i < scale; ++i)
+                {
+                    const __m256i spread = scale == 1 ? c : _mm256_permutevar8x32_epi32(c, pattern[i]);
+                    for (unsigned copy = 0; copy < scale; ++copy)
+                        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + copy * pitch + (x * scale + 8 * i) * 4), spread);
+                }
+            }
+    }
+#endif
+
+    Kernel select_kernel() noexcept
+    {
+#ifdef SCALER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return scale_avx2;
+        if (__builtin_cpu_supports("sse2")) return scale_sse2;
+#endif
+        return scale_scalar;
+    }
+
+    const Kernel kernel = select_kernel();
+}
+
+void nes::emulator::scale_rows(const unsigned char* in, unsigned rows, const std::uint32_t* colors, unsigned scale,
+                               void* out, long pitch) noexcept
+{
+    kernel(in, rows, colors, scale, static_cast<unsigned char*>(out), pitch);
+}
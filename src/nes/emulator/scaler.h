@@ -0,0 +1,14 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <cstdint>
+
+namespace nes::emulator
+{
+    // Maps rows of 256 palette indices to colors[index & 63] (XRGB8888), every pixel repeated scale
+    // times (1 to 4) across and down, into output rows pitch bytes apart
+    void scale_rows(const unsigned char* in, unsigned rows, const std::uint32_t* colors, unsigned scale,
+                    void* out, long pitch) noexcept;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include "state.h"
+
+#include "cartridge.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "controller.h"
+
+using namespace nes::emulator;
+
+namespace
+{
+    // magic, version, cartridge id, payload size
+    constexpr unsigned char magic[4]{'N', 'E', 'S', 'S'};
+    constexpr unsigned      version     = 1;
+    constexpr std::size_t   header_size = 4 + 2 + 4 + 4;
+
+    template<class Stream>
+    void machine_state(const Machine& machine, Stream& stream) noexcept
+    {
+        machine.cartridge->state(stream);
+        machine.ppu->state(stream);
+        machine.apu->state(stream);
+        machine.controller->state(stream);
+        machine.cpu->state(stream); // last, it remaps its pages from the cartridge
+    }
+
+    std::size_t payload_size(const Machine& machine) noexcept
+    {
+        StateWriter counter{nullptr, 0};
+        machine_state(machine, counter);
+        return counter.written();
+    }
+}
+
+std::size_t nes::emulator::state_size(const Machine& machine) noexcept {return header_size + payload_size(machine);}
+
+std::size_t nes::emulator::save_state(const Machine& machine, unsigned char* buffer, std::size_t size) noexcept
+{
+    const std::size_t payload = payload_size(machine);
+    if (machine.cpu->get_cpu_time() || size < header_size + payload) return 0;
+
+    StateWriter stream{buffer, size};
+    stream.bytes(magic, sizeof magic);
+    unsigned      state_version = version;
+    std::uint32_t id            = machine.cartridge->id(), payload_bytes = payload;
+    stream.u16(state_version);
+    stream.u32(id);
+    stream.u32(payload_bytes);
+    machine_state(machine, stream);
+    return stream.written();
+}
+
+bool nes::emulator::load_state(const Machine& machine, const unsigned char* buffer, std::size_t size) noexcept
+{
+    if (size < header_size) return false;
+
+    StateReader stream{buffer, size};
+    unsigned char state_magic[4];
+    unsigned      state_version;
+    std::uint32_t id, payload_bytes;
+    stream.bytes(state_magic, sizeof state_magic);
+    stream.u16(state_version);
+    stream.u32(id);
+    stream.u32(payload_bytes);
+
+    const std::size_t payload = payload_size(machine);
+    if (std::memcmp(state_magic, magic, sizeof magic) || state_version != version || id != machine.cartridge->id() ||
+        payload_bytes != payload || size < header_size + payload)
+        return false;
+
+    machine_state(machine, stream);
+    return true;
+}
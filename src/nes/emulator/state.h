@@ -0,0 +1,102 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace nes::emulator
+{
+    class CPU;
+    class PPU;
+    class APU;
+    class Cartridge;
+    class Controller;
+
+    // The components list their fields once in a state(Stream&) member template, which either
+    // writes them to or reads them from a caller buffer, little-endian, in fixed widths
+    class StateWriter final
+    {
+        unsigned char* data;
+        std::size_t    size, position = 0;
+
+        void put(std::uint64_t value, unsigned width) noexcept
+        {
+            if (position + width <= size)
+                for (unsigned i = 0; i < width; ++i) data[position + i] = value >> 8 * i & 0xFF;
+            position += width;
+        }
+
+    public:
+        static constexpr bool loading = false;
+
+        // a null buffer only counts the bytes
+        StateWriter(unsigned char* data, std::size_t size) noexcept : data{data}, size{data ? size : 0} {}
+
+        template<class T> void u8 (T& value) noexcept {put(static_cast<std::uint64_t>(value), 1);}
+        template<class T> void u16(T& value) noexcept {put(static_cast<std::uint64_t>(value), 2);}
+        template<class T> void u32(T& value) noexcept {put(static_cast<std::uint64_t>(value), 4);}
+        template<class T> void u64(T& value) noexcept {put(static_cast<std::uint64_t>(value), 8);}
+        void flag(bool& value) noexcept {put(value, 1);}
+        void bytes(const void* values, std::size_t count) noexcept
+        {
+            if (position + count <= size) std::memcpy(data + position, values, count);
+            position += count;
+        }
+
+        std::size_t written() const noexcept {return position;}
+    };
+
+    class StateReader final
+    {
+        const unsigned char* data;
+        std::size_t          size, position = 0;
+
+        std::uint64_t get(unsigned width) noexcept
+        {
+            std::uint64_t value = 0;
+            if (position + width <= size)
+                for (unsigned i = 0; i < width; ++i) value |= std::uint64_t{data[position + i]} << 8 * i;
+            position += width;
+            return value;
+        }
+
+    public:
+        static constexpr bool loading = true;
+
+        StateReader(const unsigned char* data, std::size_t size) noexcept : data{data}, size{size} {}
+
+        template<class T> void u8 (T& value) noexcept {value = static_cast<T>(get(1));}
+        template<class T> void u16(T& value) noexcept {value = static_cast<T>(get(2));}
+        template<class T> void u32(T& value) noexcept {value = static_cast<T>(get(4));}
+        template<class T> void u64(T& value) noexcept {value = static_cast<T>(get(8));}
+        void flag(bool& value) noexcept {value = get(1);}
+        void bytes(void* values, std::size_t count) noexcept
+        {
+            if (position + count <= size) std::memcpy(values, data + position, count);
+            position += count;
+        }
+    };
+
+    struct Machine
+    {
+        CPU*        cpu;
+        PPU*        ppu;
+        APU*        apu;
+        Cartridge*  cartridge;
+        Controller* controller;
+    };
+
+    // the bytes a state of this machine takes; it only depends on the cartridge
+    std::size_t state_size(const Machine& machine) noexcept;
+
+    // Saves the machine between two frames (right after CPU::reset_cpu_time()). Returns the bytes
+    // written, 0 if the buffer is too small or the CPU is in the middle of a frame
+    std::size_t save_state(const Machine& machine, unsigned char* buffer, std::size_t size) noexcept;
+
+    // Returns false and leaves the machine untouched if the data is not a state of this version
+    // saved with the same cartridge
+    bool load_state(const Machine& machine, const unsigned char* buffer, std::size_t size) noexcept;
+}
+
+#endif
@@ -57,6 +57,11 @@ public:
 	void save_snapshot( apu_snapshot_t* out ) const;
 	void load_snapshot( apu_snapshot_t const& );
 	
+	// Time of the next frame IRQ, which the snapshot does not hold; restore it
+	// after load_snapshot()
+	cpu_time_t frame_irq_time() const { return next_irq; }
+	void frame_irq_time( cpu_time_t t ) { next_irq = t; irq_changed(); }
+	
 	// Set overall volume (default is 1.0)
 	void volume( double );
 	
@@ -68,7 +73,8 @@ public:
 	void treble_eq( const blip_eq_t& );
 	
 	// Set sound output of specific oscillator to buffer. If buffer is NULL,
-	// the specified oscillator is muted and emulation accuracy is reduced.
+	// the specified oscillator is muted and emulation accuracy is reduced
+	// (the DMC still reads and raises its IRQ exactly).
 	// The oscillators are indexed as follows: 0) Square 1, 1) Square 2,
 	// 2) Triangle, 3) Noise, 4) DMC.
 	enum { osc_count = 5 };
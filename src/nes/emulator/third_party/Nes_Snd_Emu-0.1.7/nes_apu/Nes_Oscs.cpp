@@ -360,11 +360,9 @@ void Nes_Dmc::fill_buffer()
 
 void Nes_Dmc::run( cpu_time_t time, cpu_time_t end_time )
 {
-	if ( !output )
-		return;
-	
+	// runs without output too, since its reads and IRQ are visible to the CPU
 	int delta = update_amp( dac );
-	if ( delta )
+	if ( delta && output )
 		synth.offset( time, delta, output );
 	
 	time += delay;
@@ -392,7 +390,8 @@ void Nes_Dmc::run( cpu_time_t time, cpu_time_t end_time )
 					bits >>= 1;
 					if ( unsigned (dac + step) <= 0x7F ) {
 						dac += step;
-						synth.offset_inline( time, step, output );
+						if ( output )
+							synth.offset_inline( time, step, output );
 					}
 				}
 				
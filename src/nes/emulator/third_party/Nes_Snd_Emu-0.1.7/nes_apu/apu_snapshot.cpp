@@ -43,6 +43,7 @@ struct apu_reflection
 	{
 		REFLECT( state.delay,           osc.delay );
 		REFLECT( state.length,          osc.length_counter );
+		REFLECT( state.phase,           osc.phase );
 		REFLECT( state.linear_counter,  osc.linear_counter );
 		REFLECT( state.linear_mode,     osc.reg_written [3] );
 	}
@@ -11,7 +11,7 @@ of the base 64 color palette. */
 handle things however it wants. */
 
 /* Bits per pixel of output. Can be 15, 16, 32, or 24 (same as 32). */
-#define NES_NTSC_OUT_DEPTH 15
+#define NES_NTSC_OUT_DEPTH 32
 
 /* Type of input pixel values. You'll probably use unsigned short
 if you enable emphasis above. */